@@ -31,6 +31,7 @@
 
 #include "seasidefilteredmodel.h"
 #include "seasideperson.h"
+#include "seasidesearchindex.h"
 
 #include <synchronizelists.h>
 
@@ -41,14 +42,16 @@
 #include <QContactEmailAddress>
 #include <QContactFavorite>
 #include <QContactName>
-#include <QContactNickname>
 #include <QContactOnlineAccount>
-#include <QContactOrganization>
 #include <QContactPhoneNumber>
 #include <QContactGlobalPresence>
 #include <QContactPresence>
-#include <QTextBoundaryFinder>
 
+#include <QFutureWatcher>
+#include <QPair>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
 #include <QtDebug>
 
 namespace {
@@ -67,16 +70,398 @@ const QByteArray emailAddressesRole("emailAddresses");
 const QByteArray accountUrisRole("accountUris");
 const QByteArray accountPathsRole("accountPaths");
 const QByteArray personRole("person");
+const QByteArray matchRangesRole("matchRanges");
+const QString matchStart(QLatin1String("start"));
+const QString matchLength(QLatin1String("length"));
 
+// The number of refinement steps that can be reverted without rescanning
+const int maxFilterHistory = 32;
+
+// A refinement removing more separate ranges of rows than this resets the model instead,
+// as does one removing most of the rows in more than a few ranges
+const int maxRemovalRanges = 64;
+const int fewRemovalRanges = 4;
+
+// The smallest number of contacts worth matching on another thread
+const int minimumChunkSize = 512;
+
+// Reordering the rows by more moves than this resets the model instead
+const int maxMovedRows = 64;
+
+// The number of rows beyond the visible rows requested for completion at a time
+const int prefetchBatchSize = 16;
+
+// The number of rows beyond the visible rows relabelled at a time
+const int relabelBatchSize = 64;
+
+// The relevance of a match of each filter word: to a whole name, the start of a name, or
+// to a whole word of another detail. Favorites are more relevant still.
+const int wholeNameScore = 3;
+const int namePrefixScore = 2;
+const int wholeTokenScore = 1;
+const int favoriteScore = 1;
+
+// The fewest digits a pattern must have to be matched within phone numbers
+const int minimumNumberDigits = 3;
+
+// Returns the digits of the pattern if it consists of digits and number punctuation only
+QString numberPattern(const QString &pattern)
+{
+    static const QString punctuation(QLatin1String(" +-()./"));
+
+    foreach (const QChar &c, pattern) {
+        if (!c.isDigit() && !punctuation.contains(c))
+            return QString();
+    }
+
+    const QString digits(SeasideSearchIndex::numberDigits(pattern));
+    return digits.length() >= minimumNumberDigits ? digits : QString();
+}
+
+// Returns the folded words of the pattern
+QStringList patternParts(const QString &pattern)
+{
+    QStringList parts(SeasideSearchIndex::splitWords(pattern));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    // Qt5 does not recognize '#' as a word
+    if (parts.isEmpty() && !pattern.isEmpty()) {
+        parts.append(pattern);
+    }
+#endif
+    for (int i = 0; i < parts.count(); ++i)
+        parts[i] = SeasideSearchIndex::foldString(parts.at(i));
+    return parts;
+}
+
+// Returns true if each of the previous words starts one of the words, so that whatever
+// matches the words also matched the previous words, wherever the words were edited
+bool refinesWords(const QStringList &parts, const QStringList &previousParts)
+{
+    foreach (const QString &previous, previousParts) {
+        bool refined = false;
+        foreach (const QString &part, parts) {
+            if (part.startsWith(previous)) {
+                refined = true;
+                break;
+            }
+        }
+        if (!refined)
+            return false;
+    }
+    return true;
+}
+
+// Returns the value of a role that depends only on the details of the contact
+QVariant contactValue(const QContact &contact, int role)
+{
+    if (role == SeasideFilteredModel::FirstNameRole || role == SeasideFilteredModel::LastNameRole) {
+        QContactName name = contact.detail<QContactName>();
+        return role == SeasideFilteredModel::FirstNameRole
+                ? name.firstName()
+                : name.lastName();
+    } else if (role == SeasideFilteredModel::FavoriteRole) {
+        return contact.detail<QContactFavorite>().isFavorite();
+    } else if (role == SeasideFilteredModel::AvatarRole || role == SeasideFilteredModel::AvatarUrlRole) {
+        QUrl avatarUrl = contact.detail<QContactAvatar>().imageUrl();
+        if (role == SeasideFilteredModel::AvatarUrlRole || !avatarUrl.isEmpty()) {
+            return avatarUrl;
+        }
+        // Return the default avatar path for when no avatar URL is available
+        return QUrl(QLatin1String("image://theme/icon-m-telephony-contact-avatar"));
+    } else if (role == SeasideFilteredModel::GlobalPresenceStateRole) {
+        QContactGlobalPresence presence = contact.detail<QContactGlobalPresence>();
+        return presence.isEmpty()
+                ? QContactPresence::PresenceUnknown
+                : presence.presenceState();
+    } else if (role == SeasideFilteredModel::PhoneNumbersRole) {
+        QStringList rv;
+        foreach (const QContactPhoneNumber &number, contact.details<QContactPhoneNumber>()) {
+            rv.append(number.number());
+        }
+        return rv;
+    } else if (role == SeasideFilteredModel::EmailAddressesRole) {
+        QStringList rv;
+        foreach (const QContactEmailAddress &address, contact.details<QContactEmailAddress>()) {
+            rv.append(address.emailAddress());
+        }
+        return rv;
+    } else if (role == SeasideFilteredModel::AccountPathsRole) {
+        QStringList rv;
+        foreach (const QContactOnlineAccount &account, contact.details<QContactOnlineAccount>()) {
+            rv.append(account.value<QString>(QContactOnlineAccount__FieldAccountPath));
+        }
+        return rv;
+    } else if (role == SeasideFilteredModel::AccountUrisRole) {
+        QStringList rv;
+        foreach (const QContactOnlineAccount &account, contact.details<QContactOnlineAccount>()) {
+            rv.append(account.accountUri());
+        }
+        return rv;
+    }
+
+    return QVariant();
+}
+
+// Identifies the role values among the listeners of a cache item
+char roleValuesKey;
+
+// Numbers the updates recorded by the role values, so that each model notifies the changes of
+// an update only once
+quint64 roleValuesSerial = 0;
+
+const int roleValueCount = SeasideFilteredModel::AccountPathsRole - SeasideFilteredModel::FirstNameRole + 1;
+
+// The roles kept with the item; the section bucket depends on the display label order, and
+// the contact id is at hand
+const quint32 keptRoles = ((1u << roleValueCount) - 1)
+        & ~(1u << (SeasideFilteredModel::SectionBucketRole - SeasideFilteredModel::FirstNameRole))
+        & ~(1u << (SeasideFilteredModel::ContactIdRole - SeasideFilteredModel::FirstNameRole));
+
+// The role values of a cache item that are costly to extract from its details, kept until the
+// item is updated. They are shared by every model presenting the item.
+struct RoleValues : public SeasideCache::ItemListener
+{
+    RoleValues(SeasideCache::CacheItem *item)
+        : valid(0)
+        , changed(keptRoles)
+        , labelChanged(true)
+        , serial(0)
+        , contactState(item->contactState)
+        , displayLabel(item->displayLabel)
+        , nameGroup(item->nameGroup)
+    {
+    }
+
+    // Notes which of the values differ from those extracted before the update, so that the
+    // models can notify only the roles that changed. A value not extracted since the previous
+    // update is presumed to have changed.
+    void itemUpdated(SeasideCache::CacheItem *item)
+    {
+        if (item->contactState != contactState) {
+            // Completion may have added any of the details
+            valid = 0;
+            contactState = item->contactState;
+        }
+
+        changed = keptRoles & ~valid;
+        for (int i = 0; i < roleValueCount; ++i) {
+            if (valid & (1u << i)) {
+                const QVariant value(contactValue(item->contact, SeasideFilteredModel::FirstNameRole + i));
+                if (value != values[i]) {
+                    values[i] = value;
+                    changed |= (1u << i);
+                }
+            }
+        }
+
+        labelChanged = item->displayLabel != displayLabel || item->nameGroup != nameGroup;
+        displayLabel = item->displayLabel;
+        nameGroup = item->nameGroup;
+        serial = ++roleValuesSerial;
+    }
+
+    void itemAboutToBeRemoved(SeasideCache::CacheItem *item)
+    {
+        item->removeListener(this);
+        delete this;
+    }
+
+    QVariant values[roleValueCount];
+    // A bit for each of the values that is current
+    quint32 valid;
+    // A bit for each of the values that changed in the last update
+    quint32 changed;
+    // Whether the display label or name group changed in the last update
+    bool labelChanged;
+    // The serial of the last update, or zero if the values have not been updated
+    quint64 serial;
+    SeasideCache::ContactState contactState;
+    QString displayLabel;
+    QString nameGroup;
+};
+
+int currentGeneration(const QAtomicInt &generation)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    return generation.load();
+#else
+    return generation;
+#endif
+}
+
+bool hasProperties(quint64 statusFlags, int requiredProperty)
+{
+    if (requiredProperty != SeasideFilteredModel::NoPropertyRequired) {
+        bool haveMatch = (requiredProperty & SeasideFilteredModel::AccountUriRequired) && (statusFlags & QContactStatusFlags::HasOnlineAccount);
+        haveMatch |= (requiredProperty & SeasideFilteredModel::PhoneNumberRequired) && (statusFlags & QContactStatusFlags::HasPhoneNumber);
+        haveMatch |= (requiredProperty & SeasideFilteredModel::EmailAddressRequired) && (statusFlags & QContactStatusFlags::HasEmailAddress);
+        if (!haveMatch)
+            return false;
+    }
+
+    return true;
+}
+
+bool hasProperties(SeasideCache::CacheItem *item, int requiredProperty)
+{
+    return hasProperties(item->statusFlags, requiredProperty);
+}
+
+// A contiguous range of candidates, and which of them match
+struct MatchChunk
+{
+    int begin;
+    int end;
+    QBitArray matches;
+};
+
+// Evaluates matcher for each of count candidates. If parallel, the candidates are split
+// into a chunk per core and evaluated across the thread pool, and the chunks are merged
+// back in order.
+template <typename Matcher>
+QBitArray matchChunks(int count, bool parallel, const Matcher &matcher)
+{
+    const int chunkCount = parallel ? qBound(1, count / minimumChunkSize, QThread::idealThreadCount()) : 1;
+
+    QVector<MatchChunk> chunks(chunkCount);
+    for (int i = 0; i < chunkCount; ++i) {
+        chunks[i].begin = count * i / chunkCount;
+        chunks[i].end = count * (i + 1) / chunkCount;
+        chunks[i].matches.resize(chunks[i].end - chunks[i].begin);
+    }
+
+    if (chunkCount == 1) {
+        matcher(chunks[0]);
+        return chunks[0].matches;
+    }
+
+    QtConcurrent::blockingMap(chunks, matcher);
+
+    QBitArray matches(count);
+    foreach (const MatchChunk &chunk, chunks) {
+        for (int i = chunk.begin; i < chunk.end; ++i) {
+            if (chunk.matches.testBit(i - chunk.begin))
+                matches.setBit(i);
+        }
+    }
+    return matches;
+}
+
+// Matches cache items by required property and by the results of the search index. It
+// reads nothing that changes while matching, so it can be run on any thread.
+struct ItemMatcher
+{
+    typedef void result_type;
+
+    const QVector<SeasideCache::CacheItem *> *items;
+    const QSet<quint32> *indexMatches;
+    int requiredProperty;
+
+    void operator()(MatchChunk &chunk) const
+    {
+        for (int i = chunk.begin; i < chunk.end; ++i) {
+            SeasideCache::CacheItem *item = items->at(i);
+            if (item && hasProperties(item, requiredProperty)
+                    && (!indexMatches || indexMatches->contains(item->iid))) {
+                chunk.matches.setBit(i - chunk.begin);
+            }
+        }
+    }
+};
+
+}
+
+// A snapshot of everything needed to match the filter away from the GUI thread
+struct SeasideFilteredModel::FilterJob
+{
+    int generation;
+    QSharedPointer<QAtomicInt> currentGeneration;
+    QStringList parts;
+    QString number;
+    int searchMode;
+    int requiredProperty;
+    // The contacts that may match, unless any contact of the reference list may
+    bool allCandidates;
+    QVector<ContactIdType> candidates;
+    int revision;
+    QVector<JobContact> contacts;
+    QVector<ContactIdType> referenceContactIds;
+    QVector<ContactIdType> filteredContactIds;
+
+    bool isTokenized(const JobContact &contact) const;
+    void tokenize(JobContact *contact) const;
+    bool matches(const JobContact &contact) const;
+};
+
+bool SeasideFilteredModel::FilterJob::isTokenized(const JobContact &contact) const
+{
+    return contact.tokenized && (searchMode != KeypadSearch || contact.keypadTokenized);
+}
+
+void SeasideFilteredModel::FilterJob::tokenize(JobContact *contact) const
+{
+    if (!contact->tokenized) {
+        contact->tokens = SeasideSearchIndex::Tokens(SeasideSearchIndex::contactTokens(contact->contact));
+        contact->numbers = SeasideSearchIndex::contactNumbers(contact->contact);
+        contact->tokenized = true;
+    }
+    if (searchMode == KeypadSearch && !contact->keypadTokenized) {
+        contact->keypadTokens = SeasideSearchIndex::Tokens(SeasideSearchIndex::contactKeypadTokens(contact->contact));
+        contact->keypadTokenized = true;
+    }
+}
+
+// Matches a tokenized contact as filterId() matches a cache item
+bool SeasideFilteredModel::FilterJob::matches(const JobContact &contact) const
+{
+    if (!hasProperties(contact.statusFlags, requiredProperty))
+        return false;
+
+    // Numbers can also be found by any run of their digits
+    if (!number.isEmpty() && searchMode != KeypadSearch) {
+        foreach (const QString &contactNumber, contact.numbers) {
+            if (contactNumber.contains(number))
+                return true;
+        }
+    }
+
+    switch (searchMode) {
+    case FuzzySearch:
+        return contact.tokens.fuzzyMatches(parts);
+    case KeypadSearch:
+        return contact.keypadTokens.matches(parts);
+    default:
+        return contact.tokens.matches(parts);
+    }
 }
 
-struct FilterData : public SeasideCache::ItemListener
+// Records the changes synchronizeFilteredList() makes to a copy of the filtered list, for them
+// to be made to the model on the GUI thread
+struct SeasideFilteredModel::FilterAgent
 {
-    // Store additional filter keys with the cache item
-    QStringList filterKey;
+    const QSet<ContactIdType> *matches;
+    QVector<ContactIdType> filteredContactIds;
+    QList<FilterEdit> edits;
 
-    void itemUpdated(SeasideCache::CacheItem *) { filterKey.clear(); }
-    void itemAboutToBeRemoved(SeasideCache::CacheItem *) { delete this; }
+    bool filterValue(const ContactIdType &contactId) const
+    {
+        return matches->contains(contactId);
+    }
+
+    void insertRange(int index, int count, const QVector<ContactIdType> &source, int sourceIndex)
+    {
+        const FilterEdit edit = { index, count, source.mid(sourceIndex, count) };
+        for (int i = 0; i < count; ++i)
+            filteredContactIds.insert(index + i, source.at(sourceIndex + i));
+        edits.append(edit);
+    }
+
+    void removeRange(int index, int count)
+    {
+        const FilterEdit edit = { index, count, QVector<ContactIdType>() };
+        filteredContactIds.remove(index, count);
+        edits.append(edit);
+    }
 };
 
 // We could squeeze a little more performance out of QVector by inserting all the items in a
@@ -88,39 +473,82 @@ static void insert(
         destination->insert(to + i, source.at(i));
 }
 
-// Splits a string at word boundaries identified by QTextBoundaryFinder and returns a list of
-// of the fragments that occur between StartWord and EndWord boundaries.
-static QStringList splitWords(const QString &string)
+static void insertBits(QBitArray *bits, int to, int count)
 {
-    QStringList words;
-    QTextBoundaryFinder finder(QTextBoundaryFinder::Word, string);
+    const int size = bits->size();
+    bits->resize(size + count);
+    for (int i = size - 1; i >= to; --i)
+        bits->setBit(i + count, bits->testBit(i));
+    for (int i = to; i < to + count; ++i)
+        bits->clearBit(i);
+}
 
-    for (int start = 0; finder.position() != -1 && finder.position() < string.length();) {
-#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
-        if (!(finder.boundaryReasons() & QTextBoundaryFinder::StartOfItem)) {
-#else
-        if (!(finder.boundaryReasons() & QTextBoundaryFinder::StartWord)) {
-#endif
-            finder.toNextBoundary();
-            start = finder.position();
-        }
+static void removeBits(QBitArray *bits, int from, int count)
+{
+    for (int i = from; i + count < bits->size(); ++i)
+        bits->setBit(i, bits->testBit(i + count));
+    bits->resize(bits->size() - count);
+}
 
-        finder.toNextBoundary();
+// Runs on a worker thread; the job shares no mutable state with the model. Both the matching
+// and the changes to the filtered list are found here, leaving the GUI thread only the rows
+// to update.
+SeasideFilteredModel::FilterResult SeasideFilteredModel::matchFilterJob(const FilterJob &job)
+{
+    FilterResult result;
+    result.generation = job.generation;
+    result.filteredContactIds = job.filteredContactIds;
+    result.revision = job.revision;
+    result.contacts = job.contacts;
+
+    QSet<ContactIdType> candidates;
+    if (!job.allCandidates) {
+        candidates.reserve(job.candidates.count());
+        foreach (const ContactIdType &contactId, job.candidates)
+            candidates.insert(contactId);
+    }
 
-#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
-        if (finder.position() > start && finder.boundaryReasons() & QTextBoundaryFinder::EndOfItem) {
-#else
-        if (finder.position() > start && finder.boundaryReasons() & QTextBoundaryFinder::EndWord) {
-#endif
-            words.append(string.mid(start, finder.position() - start));
-            start = finder.position();
-        }
+    QSet<ContactIdType> matches;
+    for (int i = 0; i < result.contacts.count(); ++i) {
+        // Don't bother if a newer job superseded this one
+        if (currentGeneration(*job.currentGeneration) != job.generation)
+            return result;
+
+        const ContactIdType &contactId(result.contacts.at(i).contactId);
+        if (!job.allCandidates && !candidates.contains(contactId))
+            continue;
+
+        // The copy of the contacts is detached only to store the tokens found for the first time
+        if (!job.isTokenized(result.contacts.at(i)))
+            job.tokenize(&result.contacts[i]);
+        if (job.matches(result.contacts.at(i)))
+            matches.insert(contactId);
     }
-    return words;
+
+    FilterAgent agent;
+    agent.matches = &matches;
+    agent.filteredContactIds = job.filteredContactIds;
+    synchronizeFilteredList(&agent, agent.filteredContactIds, job.referenceContactIds);
+    result.edits = agent.edits;
+
+    return result;
 }
 
 SeasideFilteredModel::SeasideFilteredModel(QObject *parent)
     : SeasideCache::ListModel(parent)
+    , m_indexedContactIds(0)
+    , m_propertyRowsContactIds(0)
+    , m_referenceRowsContactIds(0)
+    , m_searchIndex(SeasideSearchIndex::acquire())
+    , m_useIndexMatches(false)
+    , m_termGeneration(-1)
+    , m_termSearchMode(PrefixSearch)
+    , m_resultShared(false)
+    , m_roleSerial(0)
+    , m_filterWatcher(new QFutureWatcher<FilterResult>(this))
+    , m_filterGeneration(new QAtomicInt(0))
+    , m_jobContactsIds(0)
+    , m_jobRevision(0)
     , m_filterIndex(0)
     , m_referenceIndex(0)
     , m_filterType(FilterAll)
@@ -128,11 +556,38 @@ SeasideFilteredModel::SeasideFilteredModel(QObject *parent)
     , m_fetchTypes(SeasideCache::FetchNone)
     , m_requiredProperty(NoPropertyRequired)
     , m_searchByFirstNameCharacter(false)
+    , m_searchMode(PrefixSearch)
+    , m_sortOrder(ReferenceOrder)
+    , m_ranked(false)
+    , m_maxResults(0)
+    , m_resultLimit(0)
+    , m_scanPosition(0)
+    , m_limited(false)
+    , m_moreResults(false)
+    , m_asynchronous(false)
+    , m_parallel(true)
+    , m_filterPending(false)
+    , m_filterDelay(0)
+    , m_pendingRequiredProperty(NoPropertyRequired)
+    , m_filterChangePending(false)
+    , m_visibleFirst(0)
+    , m_visibleLast(-1)
 {
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
     setRoleNames(roleNames());
 #endif
 
+    connect(m_filterWatcher, SIGNAL(finished()), this, SLOT(filterJobFinished()));
+
+    m_filterTimer.setSingleShot(true);
+    connect(&m_filterTimer, SIGNAL(timeout()), this, SLOT(applyPendingFilters()));
+
+    m_prefetchTimer.setSingleShot(true);
+    connect(&m_prefetchTimer, SIGNAL(timeout()), this, SLOT(prefetchBatch()));
+
+    m_relabelTimer.setSingleShot(true);
+    connect(&m_relabelTimer, SIGNAL(timeout()), this, SLOT(relabelBatch()));
+
     updateRegistration();
 
     m_referenceContactIds = SeasideCache::contacts(SeasideCache::FilterAll);
@@ -141,7 +596,10 @@ SeasideFilteredModel::SeasideFilteredModel(QObject *parent)
 
 SeasideFilteredModel::~SeasideFilteredModel()
 {
+    cancelFilterJob();
     SeasideCache::unregisterModel(this);
+    releaseSharedMatches();
+    m_searchIndex->release();
 }
 
 QHash<int, QByteArray> SeasideFilteredModel::roleNames() const
@@ -161,6 +619,7 @@ QHash<int, QByteArray> SeasideFilteredModel::roleNames() const
     roles.insert(AccountUrisRole, accountUrisRole);
     roles.insert(AccountPathsRole, accountPathsRole);
     roles.insert(PersonRole, personRole);
+    roles.insert(MatchRangesRole, matchRangesRole);
     return roles;
 }
 
@@ -199,6 +658,8 @@ void SeasideFilteredModel::setFilterType(FilterType type)
         m_filterType = type;
 
         if (!equivalentFilter) {
+            m_filterHistory.clear();
+
             m_referenceIndex = 0;
             m_filterIndex = 0;
 
@@ -209,7 +670,7 @@ void SeasideFilteredModel::setFilterType(FilterType type)
                 m_filteredContactIds = *m_referenceContactIds;
             }
 
-            m_referenceContactIds = SeasideCache::contacts(static_cast<SeasideCache::FilterType>(m_filterType));
+            setReferenceContactIds(SeasideCache::contacts(static_cast<SeasideCache::FilterType>(m_filterType)));
 
             updateIndex();
 
@@ -228,22 +689,110 @@ void SeasideFilteredModel::setFilterType(FilterType type)
 
 QString SeasideFilteredModel::filterPattern() const
 {
-    return m_filterPattern;
+    return m_filterChangePending ? m_pendingFilterPattern : m_filterPattern;
 }
 
 void SeasideFilteredModel::setFilterPattern(const QString &pattern)
 {
-    updateFilters(pattern, m_requiredProperty);
+    setFilters(pattern, requiredProperty());
 }
 
 int SeasideFilteredModel::requiredProperty() const
 {
-    return m_requiredProperty;
+    return m_filterChangePending ? m_pendingRequiredProperty : m_requiredProperty;
 }
 
 void SeasideFilteredModel::setRequiredProperty(int type)
 {
-    updateFilters(m_filterPattern, type);
+    setFilters(filterPattern(), type);
+}
+
+QString SeasideFilteredModel::query() const
+{
+    return m_query.query();
+}
+
+void SeasideFilteredModel::setQuery(const QString &query)
+{
+    if (m_query.query() == query)
+        return;
+
+    const bool filtered = isFiltered();
+    const int prevCount = rowCount();
+
+    m_query = SeasideQuery(query);
+
+    if (filtered || isFiltered()) {
+        // The previous results were not matched against this query
+        m_filterHistory.clear();
+        cancelFilterJob();
+        m_resultLimit = m_maxResults;
+
+        updateFilteredContacts(filtered, !isFiltered(), false, m_filterPattern, m_requiredProperty);
+
+        if (rowCount() != prevCount)
+            emit countChanged();
+    }
+
+    emit queryChanged();
+}
+
+int SeasideFilteredModel::filterDelay() const
+{
+    return m_filterDelay;
+}
+
+void SeasideFilteredModel::setFilterDelay(int delay)
+{
+    if (m_filterDelay != delay) {
+        m_filterDelay = delay;
+
+        if (m_filterDelay <= 0) {
+            m_filterTimer.stop();
+            applyPendingFilters();
+        }
+
+        emit filterDelayChanged();
+    }
+}
+
+// Applies the filters immediately, or if there is a filter delay, once the delay has
+// elapsed. The pattern and property report the new values in the meantime.
+void SeasideFilteredModel::setFilters(const QString &pattern, int property)
+{
+    if (m_filterDelay <= 0) {
+        updateFilters(pattern, property);
+        return;
+    }
+
+    const bool changedPattern = pattern != filterPattern();
+    const bool changedProperty = property != requiredProperty();
+    if (!changedPattern && !changedProperty)
+        return;
+
+    m_pendingFilterPattern = pattern;
+    m_pendingRequiredProperty = property;
+    m_filterChangePending = true;
+
+    // Don't restart the timer, so that the filters are applied at least once per interval
+    // however quickly they change.
+    if (!m_filterTimer.isActive())
+        m_filterTimer.start(m_filterDelay);
+
+    if (changedPattern)
+        emit filterPatternChanged();
+    if (changedProperty)
+        emit requiredPropertyChanged();
+}
+
+void SeasideFilteredModel::applyPendingFilters()
+{
+    if (m_filterChangePending) {
+        m_filterChangePending = false;
+
+        // The changes have already been notified
+        updateFilters(m_pendingFilterPattern, m_pendingRequiredProperty, false);
+    }
 }
 
 bool SeasideFilteredModel::searchByFirstNameCharacter() const
@@ -255,161 +804,1033 @@ void SeasideFilteredModel::setSearchByFirstNameCharacter(bool searchByFirstNameC
 {
     if (m_searchByFirstNameCharacter != searchByFirstNameCharacter) {
         m_searchByFirstNameCharacter = searchByFirstNameCharacter;
+        m_filterHistory.clear();
         emit searchByFirstNameCharacterChanged();
     }
 }
 
-template<typename T>
-void insert(QSet<T> &set, const QList<T> &list)
+SeasideFilteredModel::SearchMode SeasideFilteredModel::searchMode() const
 {
-    foreach (const T &item, list)
-        set.insert(item);
+    return m_searchMode;
 }
 
-bool SeasideFilteredModel::filterId(const ContactIdType &contactId) const
+void SeasideFilteredModel::setSearchMode(SearchMode mode)
 {
-    if (m_filterParts.isEmpty() && m_requiredProperty == NoPropertyRequired)
-        return true;
+    if (m_searchMode != mode) {
+        m_searchMode = mode;
 
-    SeasideCache::CacheItem *item = SeasideCache::existingItem(contactId);
-    if (!item)
-        return false;
+        if (!m_filterParts.isEmpty()) {
+            // The previous results were matched differently
+            const int prevCount = rowCount();
 
-    if (m_requiredProperty != NoPropertyRequired) {
-        bool haveMatch = (m_requiredProperty & AccountUriRequired) && (item->statusFlags & QContactStatusFlags::HasOnlineAccount);
-        haveMatch |= (m_requiredProperty & PhoneNumberRequired) && (item->statusFlags & QContactStatusFlags::HasPhoneNumber);
-        haveMatch |= (m_requiredProperty & EmailAddressRequired) && (item->statusFlags & QContactStatusFlags::HasEmailAddress);
-        if (!haveMatch)
-            return false;
+            m_filterHistory.clear();
+            cancelFilterJob();
+            updateIndex();
+
+            if (rowCount() != prevCount)
+                emit countChanged();
+
+            resetMatchRanges();
+        }
+
+        emit searchModeChanged();
     }
+}
 
-    if (m_searchByFirstNameCharacter && !m_filterPattern.isEmpty())
-        return m_filterPattern[0].toUpper() == SeasideCache::nameGroup(item);
+SeasideFilteredModel::SortOrder SeasideFilteredModel::sortOrder() const
+{
+    return m_sortOrder;
+}
 
-    void *key = const_cast<void *>(static_cast<const void *>(this));
-    SeasideCache::ItemListener *listener = item->listener(key);
-    if (!listener) {
-        listener = item->appendListener(new FilterData, key);
-    }
-    FilterData *filterData = static_cast<FilterData *>(listener);
-
-    // split the display label and filter into words.
-    //
-    // TODO: i18n will require different splitting for thai and possibly
-    // other locales, see MBreakIterator
-    if (filterData->filterKey.isEmpty()) {
-        QSet<QString> matchTokens;
-
-        QContactName name = item->contact.detail<QContactName>();
-        insert(matchTokens, splitWords(name.firstName()));
-        insert(matchTokens, splitWords(name.middleName()));
-        insert(matchTokens, splitWords(name.lastName()));
-        insert(matchTokens, splitWords(name.prefix()));
-        insert(matchTokens, splitWords(name.suffix()));
-
-        QContactNickname nickname = item->contact.detail<QContactNickname>();
-        insert(matchTokens, splitWords(nickname.nickname()));
-
-        // Include the custom label - it may contain the user's customized name for the contact
-#ifdef USING_QTPIM
-        insert(matchTokens, splitWords(item->contact.detail<QContactName>().value<QString>(QContactName__FieldCustomLabel)));
-#else
-        insert(matchTokens, splitWords(item->contact.detail<QContactName>().customLabel()));
-#endif
+void SeasideFilteredModel::setSortOrder(SortOrder order)
+{
+    if (m_sortOrder != order) {
+        m_sortOrder = order;
 
-        foreach (const QContactPhoneNumber &detail, item->contact.details<QContactPhoneNumber>())
-            insert(matchTokens, splitWords(detail.number()));
-        foreach (const QContactEmailAddress &detail, item->contact.details<QContactEmailAddress>())
-            insert(matchTokens, splitWords(detail.emailAddress()));
-        foreach (const QContactOrganization &detail, item->contact.details<QContactOrganization>())
-            insert(matchTokens, splitWords(detail.name()));
-        foreach (const QContactOnlineAccount &detail, item->contact.details<QContactOnlineAccount>()) {
-            insert(matchTokens, splitWords(detail.accountUri()));
-            insert(matchTokens, splitWords(detail.serviceProvider()));
-        }
-        foreach (const QContactGlobalPresence &detail, item->contact.details<QContactGlobalPresence>())
-            insert(matchTokens, splitWords(detail.nickname()));
-        foreach (const QContactPresence &detail, item->contact.details<QContactPresence>())
-            insert(matchTokens, splitWords(detail.nickname()));
-
-        filterData->filterKey = matchTokens.toList();
-    }
-
-    // search forwards over the label components for each filter word, making
-    // sure to find all filter words before considering it a match.
-    for (int i = 0; i < m_filterParts.size(); i++) {
-        bool found = false;
-        const QString &part(m_filterParts.at(i));
-        for (int j = 0; j < filterData->filterKey.size(); j++) {
-            // TODO: for good i18n, we need to search insensitively taking
-            // diacritics into account, QString's functions alone aren't good
-            // enough
-            if (filterData->filterKey.at(j).startsWith(part, Qt::CaseInsensitive)) {
-                found = true;
-                break;
-            }
+        if (!m_filterParts.isEmpty()) {
+            const int prevCount = rowCount();
+
+            cancelFilterJob();
+            updateIndex();
+
+            if (rowCount() != prevCount)
+                emit countChanged();
         }
 
-        // if the current filter word wasn't found in the search
-        // string, then it wasn't a match. we require all words
-        // to match.
-        if (!found)
-            return false;
+        emit sortOrderChanged();
     }
+}
 
-    return true;
+int SeasideFilteredModel::maxResults() const
+{
+    return m_maxResults;
 }
 
-void SeasideFilteredModel::insertRange(
-        int index, int count, const QVector<ContactIdType> &source, int sourceIndex)
+void SeasideFilteredModel::setMaxResults(int maxResults)
 {
-    beginInsertRows(QModelIndex(), index, index + count - 1);
-    for (int i = 0; i < count; ++i)
-        m_filteredContactIds.insert(index + i, source.at(sourceIndex + i));
-    endInsertRows();
+    maxResults = qMax(0, maxResults);
+    if (m_maxResults != maxResults) {
+        m_maxResults = maxResults;
+        m_resultLimit = maxResults;
+
+        if (isFiltered()) {
+            const int prevCount = rowCount();
+
+            cancelFilterJob();
+            updateIndex();
+
+            if (rowCount() != prevCount)
+                emit countChanged();
+        }
+
+        emit maxResultsChanged();
+    }
+}
+
+bool SeasideFilteredModel::hasMoreResults() const
+{
+    return m_moreResults;
+}
+
+void SeasideFilteredModel::setMoreResults(bool moreResults)
+{
+    if (m_moreResults != moreResults) {
+        m_moreResults = moreResults;
+        emit hasMoreResultsChanged();
+    }
+}
+
+bool SeasideFilteredModel::isAsynchronous() const
+{
+    return m_asynchronous;
+}
+
+void SeasideFilteredModel::setAsynchronous(bool asynchronous)
+{
+    if (m_asynchronous != asynchronous) {
+        m_asynchronous = asynchronous;
+
+        if (!m_asynchronous && m_filterPending) {
+            // Complete the outstanding filter immediately
+            const int prevCount = rowCount();
+
+            cancelFilterJob();
+            updateIndex();
+
+            if (rowCount() != prevCount)
+                emit countChanged();
+        }
+        if (!m_asynchronous) {
+            // The copies of the contacts are only needed by jobs
+            m_jobContacts.clear();
+            m_jobContactsIds = 0;
+        }
+
+        emit asynchronousChanged();
+    }
+}
+
+bool SeasideFilteredModel::isParallel() const
+{
+    return m_parallel;
+}
+
+void SeasideFilteredModel::setParallel(bool parallel)
+{
+    if (m_parallel != parallel) {
+        m_parallel = parallel;
+        emit parallelChanged();
+    }
+}
+
+bool SeasideFilteredModel::filterId(const ContactIdType &contactId) const
+{
+    if (m_filterParts.isEmpty() && m_requiredProperty == NoPropertyRequired && m_query.isEmpty())
+        return true;
+
+    SeasideCache::CacheItem *item = SeasideCache::existingItem(contactId);
+    if (!item || !hasRequiredProperty(item) || !m_query.matches(item, m_searchIndex))
+        return false;
+
+    if (m_searchByFirstNameCharacter && !m_filterPattern.isEmpty())
+        return m_filterPattern[0].toUpper() == SeasideCache::nameGroup(item);
+
+    // Numbers can also be found by any run of their digits
+    if (!m_filterNumber.isEmpty() && m_searchMode != KeypadSearch && m_searchIndex->itemHasNumber(item, m_filterNumber))
+        return true;
+
+    switch (m_searchMode) {
+    case FuzzySearch:
+        return m_searchIndex->itemTokens(item).fuzzyMatches(m_filterParts);
+    case KeypadSearch:
+        return m_searchIndex->itemKeypadTokens(item).matches(m_filterParts);
+    default:
+        return m_searchIndex->itemTokens(item).matches(m_filterParts);
+    }
+}
+
+bool SeasideFilteredModel::hasRequiredProperty(SeasideCache::CacheItem *item) const
+{
+    return hasProperties(item, m_requiredProperty);
+}
+
+bool SeasideFilteredModel::filterValue(const ContactIdType &contactId) const
+{
+    if (!m_useIndexMatches)
+        return filterId(contactId);
+
+    // The filter words have already been resolved by the search index
+    SeasideCache::CacheItem *item = SeasideCache::existingItem(contactId);
+    return item && m_indexMatches.contains(item->iid) && hasRequiredProperty(item) && m_query.matches(item, m_searchIndex);
+}
+
+void SeasideFilteredModel::insertRange(
+        int index, int count, const QVector<ContactIdType> &source, int sourceIndex)
+{
+    beginInsertRows(QModelIndex(), index, index + count - 1);
+    for (int i = 0; i < count; ++i)
+        m_filteredContactIds.insert(index + i, source.at(sourceIndex + i));
+    endInsertRows();
+}
+
+void SeasideFilteredModel::removeRange(int index, int count)
+{
+    beginRemoveRows(QModelIndex(), index, index + count - 1);
+    m_filteredContactIds.remove(index, count);
+    endRemoveRows();
+}
+
+void SeasideFilteredModel::prepareIndexMatches()
+{
+    // Word matches can be resolved for all contacts at once by the search index, except
+    // when matching only the name group.
+    m_useIndexMatches = !m_filterParts.isEmpty() && !m_searchByFirstNameCharacter;
+    if (!m_useIndexMatches)
+        return;
+
+    if (m_indexedContactIds != m_referenceContactIds) {
+        m_searchIndex->insertItems(*m_referenceContactIds, 0, m_referenceContactIds->count() - 1, m_parallel);
+        m_indexedContactIds = m_referenceContactIds;
+    }
+
+    // The matches of words that were also in the previous pattern are still valid, unless the
+    // index has changed since, so only the edited words need to be resolved
+    if (m_termGeneration != m_searchIndex->generation() || m_termSearchMode != m_searchMode) {
+        m_termMatches.clear();
+        m_termGeneration = m_searchIndex->generation();
+        m_termSearchMode = m_searchMode;
+    }
+
+    QHash<QString, QSet<quint32> > termMatches;
+    foreach (const QString &part, m_filterParts) {
+        if (termMatches.contains(part))
+            continue;
+
+        QHash<QString, QSet<quint32> >::const_iterator previous = m_termMatches.constFind(part);
+        termMatches.insert(part, previous != m_termMatches.constEnd() ? *previous : termMatch(part));
+    }
+    m_termMatches = termMatches;
+
+    // Every word must be matched, so intersect the others with the fewest matches
+    QHash<QString, QSet<quint32> >::const_iterator smallest = m_termMatches.constBegin();
+    for (QHash<QString, QSet<quint32> >::const_iterator it = m_termMatches.constBegin(); it != m_termMatches.constEnd(); ++it) {
+        if (it->count() < smallest->count())
+            smallest = it;
+    }
+
+    m_indexMatches = *smallest;
+    for (QHash<QString, QSet<quint32> >::const_iterator it = m_termMatches.constBegin(); it != m_termMatches.constEnd(); ++it) {
+        if (m_indexMatches.isEmpty())
+            break;
+        if (it != smallest)
+            m_indexMatches.intersect(*it);
+    }
+
+    if (!m_filterNumber.isEmpty() && m_searchMode != KeypadSearch)
+        m_indexMatches.unite(m_searchIndex->numberMatch(m_filterNumber));
+}
+
+QSet<quint32> SeasideFilteredModel::termMatch(const QString &part)
+{
+    switch (m_searchMode) {
+    case FuzzySearch:
+        return m_searchIndex->fuzzyMatch(QStringList() << part);
+    case KeypadSearch:
+        return m_searchIndex->keypadMatch(QStringList() << part);
+    default:
+        return m_searchIndex->match(QStringList() << part);
+    }
+}
+
+void SeasideFilteredModel::releaseIndexMatches()
+{
+    m_useIndexMatches = false;
+    m_indexMatches.clear();
+}
+
+// Returns a bitmap of the candidates that match the filter, evaluated in parallel if possible.
+// Finds the matches of the reference list stored by a model with the same filter, since the
+// reference list and its items last changed. Matches found by the name group or a query are
+// not shared, since the search index does not observe all the changes affecting them.
+bool SeasideFilteredModel::sharedMatches(QBitArray *matches)
+{
+    if (m_filterParts.isEmpty() || m_searchByFirstNameCharacter || !m_query.isEmpty()) {
+        releaseSharedMatches();
+        return false;
+    }
+
+    const SeasideSearchIndex::ResultKey key = { m_effectiveFilterType, m_requiredProperty, m_searchMode, m_filterParts, m_filterNumber };
+    if (!m_resultShared || !(key == m_resultKey)) {
+        releaseSharedMatches();
+        m_searchIndex->acquireResult(key);
+        m_resultKey = key;
+        m_resultShared = true;
+    }
+
+    return m_searchIndex->cachedResult(m_resultKey, *m_referenceContactIds, matches);
+}
+
+void SeasideFilteredModel::shareMatches(const QBitArray &matches)
+{
+    if (m_resultShared)
+        m_searchIndex->storeResult(m_resultKey, *m_referenceContactIds, matches);
+}
+
+void SeasideFilteredModel::releaseSharedMatches()
+{
+    if (m_resultShared) {
+        m_searchIndex->releaseResult(m_resultKey);
+        m_resultShared = false;
+    }
+}
+
+QBitArray SeasideFilteredModel::referenceMatches()
+{
+    QBitArray matches;
+    if (sharedMatches(&matches))
+        return matches;
+
+    prepareIndexMatches();
+    matches = matchCandidates(*m_referenceContactIds);
+    releaseIndexMatches();
+
+    shareMatches(matches);
+    return matches;
+}
+
+QBitArray SeasideFilteredModel::matchCandidates(const QVector<ContactIdType> &candidates)
+{
+    if (!isFiltered())
+        return QBitArray(candidates.count(), true);
+
+    // The required property of the reference list is known without visiting any contacts
+    const bool referenceRows = &candidates == m_referenceContactIds && m_requiredProperty != NoPropertyRequired;
+
+    QBitArray matches;
+    if (referenceRows && m_filterParts.isEmpty()) {
+        matches = requiredPropertyRows();
+    } else if (!m_useIndexMatches && !m_filterParts.isEmpty()) {
+        // Matching the name group must be done on this thread
+        matches.resize(candidates.count());
+        for (int i = 0; i < candidates.count(); ++i) {
+            if (filterValue(candidates.at(i)))
+                matches.setBit(i);
+        }
+
+        // The query has been matched by filterId
+        return matches;
+    } else {
+        // Only the cache lookups need to be made here
+        QVector<SeasideCache::CacheItem *> items(candidates.count());
+        for (int i = 0; i < candidates.count(); ++i)
+            items[i] = SeasideCache::existingItem(candidates.at(i));
+
+        const ItemMatcher matcher = { &items, m_useIndexMatches ? &m_indexMatches : 0, referenceRows ? int(NoPropertyRequired) : m_requiredProperty };
+        matches = matchChunks(candidates.count(), m_parallel, matcher);
+
+        if (referenceRows)
+            matches &= requiredPropertyRows();
+    }
+
+    if (!m_query.isEmpty()) {
+        // The query reads details and tokens that are only safe to use on this thread, so it
+        // is left to last, to be checked for the remaining candidates only
+        for (int i = 0; i < candidates.count(); ++i) {
+            if (!matches.testBit(i))
+                continue;
+
+            SeasideCache::CacheItem *item = SeasideCache::existingItem(candidates.at(i));
+            if (!item || !m_query.matches(item, m_searchIndex))
+                matches.clearBit(i);
+        }
+    }
+
+    return matches;
+}
+
+// Returns a bitmap of the rows of the reference list having any of the required properties.
+QBitArray SeasideFilteredModel::requiredPropertyRows()
+{
+    const int count = m_referenceContactIds->count();
+    if (m_propertyRowsContactIds != m_referenceContactIds || m_phoneNumberRows.count() != count) {
+        m_accountUriRows = QBitArray(count);
+        m_phoneNumberRows = QBitArray(count);
+        m_emailAddressRows = QBitArray(count);
+        m_propertyRowsContactIds = m_referenceContactIds;
+
+        updatePropertyRows(0, count - 1);
+    }
+
+    QBitArray rows(count);
+    if (m_requiredProperty & AccountUriRequired)
+        rows |= m_accountUriRows;
+    if (m_requiredProperty & PhoneNumberRequired)
+        rows |= m_phoneNumberRows;
+    if (m_requiredProperty & EmailAddressRequired)
+        rows |= m_emailAddressRows;
+    return rows;
+}
+
+void SeasideFilteredModel::updatePropertyRows(int begin, int end)
+{
+    for (int i = begin; i <= end; ++i) {
+        SeasideCache::CacheItem *item = SeasideCache::existingItem(m_referenceContactIds->at(i));
+        const quint64 flags = item ? item->statusFlags : 0;
+        m_accountUriRows.setBit(i, (flags & QContactStatusFlags::HasOnlineAccount) != 0);
+        m_phoneNumberRows.setBit(i, (flags & QContactStatusFlags::HasPhoneNumber) != 0);
+        m_emailAddressRows.setBit(i, (flags & QContactStatusFlags::HasEmailAddress) != 0);
+    }
+}
+
+void SeasideFilteredModel::setReferenceContactIds(const QVector<ContactIdType> *contactIds)
+{
+    m_referenceContactIds = contactIds;
+
+    // Changes to the list weren't reported while it wasn't the reference list
+    m_indexedContactIds = 0;
+    m_propertyRowsContactIds = 0;
+    m_referenceRowsContactIds = 0;
+    m_jobContactsIds = 0;
+}
+
+// Returns the row of a contact in the reference list, or -1 if it is not present.
+int SeasideFilteredModel::referenceRow(const ContactIdType &contactId)
+{
+    if (m_referenceRowsContactIds != m_referenceContactIds) {
+        // The rows are rebuilt after the list has changed, but not for changes to the contacts
+        m_referenceRows.clear();
+        m_referenceRows.reserve(m_referenceContactIds->count());
+        for (int i = 0; i < m_referenceContactIds->count(); ++i)
+            m_referenceRows.insert(m_referenceContactIds->at(i), i);
+        m_referenceRowsContactIds = m_referenceContactIds;
+    }
+
+    return m_referenceRows.value(contactId, -1);
+}
+
+// Returns the first row of the filtered list whose contact is at or after a row of the
+// reference list. The filtered list is in reference order, so it can be searched by bisection.
+int SeasideFilteredModel::filteredLowerBound(int referenceIndex)
+{
+    int begin = 0;
+    int end = m_filteredContactIds.count();
+    while (begin < end) {
+        const int middle = begin + (end - begin) / 2;
+        if (referenceRow(m_filteredContactIds.at(middle)) < referenceIndex) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return begin;
+}
+
+void SeasideFilteredModel::refineIndex()
+{
+    if (startFilterJob(m_filteredContactIds))
+        return;
+
+    // Another model may have matched the same filter already
+    QBitArray sharedRows;
+    if (sharedMatches(&sharedRows)) {
+        applyMatches(*m_referenceContactIds, sharedRows);
+        return;
+    }
+
+    prepareIndexMatches();
+    const QBitArray matches(matchCandidates(m_filteredContactIds));
+    releaseIndexMatches();
+
+    if (m_resultShared) {
+        // Share the matches as rows of the reference list, of which the filtered list is a subsequence
+        const QVector<ContactIdType> &reference(*m_referenceContactIds);
+        QBitArray rows(reference.count());
+        int row = 0;
+        for (int i = 0; i < reference.count() && row < m_filteredContactIds.count(); ++i) {
+            if (reference.at(i) == m_filteredContactIds.at(row)) {
+                if (matches.testBit(row))
+                    rows.setBit(i);
+                ++row;
+            }
+        }
+        if (row == m_filteredContactIds.count())
+            shareMatches(rows);
+    }
+
+    // The filtered list is a guaranteed sub-set of the current list, so just find the runs
+    // of items that don't match the filter.
+    QVector<QPair<int, int> > ranges;
+    int removed = 0;
+    for (int i = 0; i < matches.count();) {
+        int count = 0;
+        for (; i + count < matches.count(); ++count) {
+            if (matches.testBit(i + count))
+                break;
+        }
+
+        if (count > 0) {
+            ranges.append(qMakePair(i, count));
+            removed += count;
+            i += count;
+        } else {
+            ++i;
+        }
+    }
+
+    if (ranges.isEmpty())
+        return;
+
+    if (ranges.count() > maxRemovalRanges
+            || (ranges.count() > fewRemovalRanges && removed * 2 > m_filteredContactIds.count())) {
+        // Views handle a reset much faster than many removals, and the list can then be
+        // compacted in a single pass.
+        beginResetModel();
+        int count = 0;
+        for (int i = 0; i < matches.count(); ++i) {
+            if (matches.testBit(i))
+                m_filteredContactIds[count++] = m_filteredContactIds.at(i);
+        }
+        m_filteredContactIds.resize(count);
+        endResetModel();
+        return;
+    }
+
+    // Each range must be removed as it is reported for the rows to stay consistent, but
+    // there are few enough of them that the cost of doing so is bounded.
+    removed = 0;
+    for (int i = 0; i < ranges.count(); ++i) {
+        const int row = ranges.at(i).first - removed;
+        const int count = ranges.at(i).second;
+
+        beginRemoveRows(QModelIndex(), row, row + count - 1);
+        m_filteredContactIds.remove(row, count);
+        endRemoveRows();
+
+        removed += count;
+    }
+}
+
+void SeasideFilteredModel::updateIndex()
+{
+    if (isRanking()) {
+        rankIndex();
+        return;
+    }
+    if (isLimiting()) {
+        limitIndex();
+        return;
+    }
+
+    if (m_ranked || m_limited) {
+        // Return to every match, in reference order
+        const QBitArray matches(referenceMatches());
+
+        QVector<ContactIdType> contactIds;
+        contactIds.reserve(matches.count(true));
+        for (int i = 0; i < matches.count(); ++i) {
+            if (matches.testBit(i))
+                contactIds.append(m_referenceContactIds->at(i));
+        }
+        publishOrder(contactIds);
+        m_ranked = false;
+        m_limited = false;
+        m_relevance.clear();
+        setMoreResults(false);
+        return;
+    }
+
+    if (isFiltered() && startFilterJob(*m_referenceContactIds))
+        return;
+
+    if (isSubsequence(m_filteredContactIds, *m_referenceContactIds)) {
+        applyMatches(*m_referenceContactIds, referenceMatches());
+    } else {
+        // The filtered list is from a different reference list
+        prepareIndexMatches();
+        synchronizeFilteredList(this, m_filteredContactIds, *m_referenceContactIds);
+        releaseIndexMatches();
+    }
+}
+
+// Orders the matches by relevance. There are few distinct scores, so the matches are
+// distributed to a bucket per score in a single pass, which keeps equally relevant matches
+// in reference order without sorting.
+void SeasideFilteredModel::rankIndex()
+{
+    const QBitArray matches(referenceMatches());
+
+    m_relevance.clear();
+
+    const int maximumScore = wholeNameScore * m_filterParts.count() + favoriteScore;
+    QVector<QVector<ContactIdType> > buckets(maximumScore + 1);
+    for (int i = 0; i < matches.count(); ++i) {
+        if (!matches.testBit(i))
+            continue;
+
+        const ContactIdType &contactId(m_referenceContactIds->at(i));
+        if (SeasideCache::CacheItem *item = SeasideCache::existingItem(contactId)) {
+            const int score = qMin(relevance(item), maximumScore);
+            m_relevance.insert(contactId, score);
+            buckets[score].append(contactId);
+        }
+    }
+
+    QVector<ContactIdType> contactIds;
+    contactIds.reserve(matches.count(true));
+    for (int score = maximumScore; score >= 0; --score)
+        contactIds += buckets.at(score);
+
+    // Only the most relevant matches are wanted
+    m_limited = isLimiting();
+    const bool moreResults = m_limited && contactIds.count() > m_resultLimit;
+    if (moreResults)
+        contactIds.resize(m_resultLimit);
+
+    publishOrder(contactIds);
+    m_ranked = true;
+    setMoreResults(moreResults);
+}
+
+// Finds the first matches up to the result limit, in reference order. The scan stops at the
+// first match beyond the limit, so its cost depends on how many results are wanted rather
+// than on the number of contacts.
+void SeasideFilteredModel::limitIndex()
+{
+    const QVector<ContactIdType> &reference(*m_referenceContactIds);
+
+    prepareIndexMatches();
+    QVector<ContactIdType> contactIds;
+    int i = 0;
+    for ( ; i < reference.count(); ++i) {
+        if (!filterValue(reference.at(i)))
+            continue;
+        if (contactIds.count() == m_resultLimit)
+            break;
+        contactIds.append(reference.at(i));
+    }
+    releaseIndexMatches();
+
+    m_scanPosition = i;
+    publishOrder(contactIds);
+    m_ranked = false;
+    m_limited = true;
+    m_relevance.clear();
+    setMoreResults(i < reference.count());
+}
+
+// Returns the row of the ranked list before which a match of the given relevance and row of the
+// reference list belongs, as if skipRow were not in the list. The list is ordered by descending
+// relevance and then by reference row, so it can be searched by bisection.
+int SeasideFilteredModel::rankedLowerBound(int score, int referenceIndex, int skipRow)
+{
+    int begin = 0;
+    int end = m_filteredContactIds.count() - (skipRow != -1 ? 1 : 0);
+    while (begin < end) {
+        const int middle = begin + (end - begin) / 2;
+        const ContactIdType &contactId(m_filteredContactIds.at(skipRow != -1 && middle >= skipRow ? middle + 1 : middle));
+        const int middleScore = m_relevance.value(contactId);
+        if (middleScore > score || (middleScore == score && referenceRow(contactId) < referenceIndex)) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return begin;
+}
+
+// Moves a changed contact of the ranked list to the row of its new relevance, or inserts or
+// removes it. Returns false if a match beyond the result limit may have become more relevant
+// than the last row, which can only be found by ranking all the matches again.
+bool SeasideFilteredModel::updateRankedRow(int referenceIndex, bool changed, const QVector<int> &roles)
+{
+    const ContactIdType &contactId(m_referenceContactIds->at(referenceIndex));
+
+    // The contact is found by the relevance it was ranked with
+    int row = -1;
+    const int previousScore = m_relevance.value(contactId, -1);
+    if (previousScore != -1) {
+        row = rankedLowerBound(previousScore, referenceIndex, -1);
+        if (row == m_filteredContactIds.count() || m_filteredContactIds.at(row) != contactId)
+            row = -1;
+    }
+
+    SeasideCache::CacheItem *item = SeasideCache::existingItem(contactId);
+    if (!item || !filterId(contactId)) {
+        m_relevance.remove(contactId);
+        if (row == -1)
+            return true;
+
+        removeRange(row, 1);
+        return !m_moreResults;
+    }
+
+    const int maximumScore = wholeNameScore * m_filterParts.count() + favoriteScore;
+    const int score = qMin(relevance(item), maximumScore);
+    m_relevance.insert(contactId, score);
+
+    const int target = rankedLowerBound(score, referenceIndex, row);
+    if (row == -1) {
+        if (m_limited && target >= m_resultLimit) {
+            // Not among the most relevant matches
+            setMoreResults(true);
+            return true;
+        }
+
+        insertRange(target, 1, *m_referenceContactIds, referenceIndex);
+        if (m_limited && m_filteredContactIds.count() > m_resultLimit) {
+            removeRange(m_filteredContactIds.count() - 1, 1);
+            setMoreResults(true);
+        }
+        return true;
+    }
+
+    if (m_moreResults && score < previousScore && target == m_filteredContactIds.count() - 1)
+        return false;
+
+    if (target != row) {
+        beginMoveRows(QModelIndex(), row, row, QModelIndex(), target > row ? target + 1 : target);
+        m_filteredContactIds.remove(row);
+        m_filteredContactIds.insert(target, contactId);
+        endMoveRows();
+    }
+    if (changed)
+        notifyDataChanged(target, target, roles);
+    return true;
+}
+
+// Returns the first row of the reference list at or after from that matches the filter, or the
+// end of the list.
+int SeasideFilteredModel::findMatch(int from)
+{
+    const QVector<ContactIdType> &reference(*m_referenceContactIds);
+
+    int i = from;
+    while (i < reference.count() && !filterId(reference.at(i)))
+        ++i;
+    return i;
+}
+
+// Inserts or removes a changed contact of the limited list at the row found by bisection, so that
+// the list still holds the first matches up to the result limit.
+void SeasideFilteredModel::updateLimitedRow(int referenceIndex, bool changed, const QVector<int> &roles)
+{
+    const QVector<ContactIdType> &reference(*m_referenceContactIds);
+
+    // Contacts after the first match beyond the limit can't affect the list
+    if (referenceIndex > m_scanPosition)
+        return;
+
+    const bool match = filterId(reference.at(referenceIndex));
+    if (referenceIndex == m_scanPosition) {
+        if (!match) {
+            m_scanPosition = findMatch(referenceIndex + 1);
+            setMoreResults(m_scanPosition < reference.count());
+        }
+        return;
+    }
+
+    const int row = filteredLowerBound(referenceIndex);
+    const bool present = row < m_filteredContactIds.count() && m_filteredContactIds.at(row) == reference.at(referenceIndex);
+
+    if (present && match) {
+        if (changed)
+            notifyDataChanged(row, row, roles);
+    } else if (present) {
+        removeRange(row, 1);
+
+        if (m_scanPosition < reference.count()) {
+            // The first match beyond the limit takes the place of the removed row
+            insertRange(m_filteredContactIds.count(), 1, reference, m_scanPosition);
+            m_scanPosition = findMatch(m_scanPosition + 1);
+            setMoreResults(m_scanPosition < reference.count());
+        }
+    } else if (match) {
+        insertRange(row, 1, reference, referenceIndex);
+
+        if (m_filteredContactIds.count() > m_resultLimit) {
+            // The last row is now the first match beyond the limit
+            m_scanPosition = referenceRow(m_filteredContactIds.last());
+            removeRange(m_filteredContactIds.count() - 1, 1);
+            setMoreResults(true);
+        }
+    }
+}
+
+int SeasideFilteredModel::relevance(SeasideCache::CacheItem *item) const
+{
+    const SeasideSearchIndex::Tokens names(m_searchIndex->itemNameTokens(item));
+    const SeasideSearchIndex::Tokens tokens(m_searchIndex->itemTokens(item));
+
+    int score = 0;
+    foreach (const QString &part, m_filterParts) {
+        if (names.contains(part)) {
+            score += wholeNameScore;
+        } else if (names.containsPrefix(part)) {
+            score += namePrefixScore;
+        } else if (tokens.contains(part)) {
+            score += wholeTokenScore;
+        }
+    }
+
+    if (item->contact.detail<QContactFavorite>().isFavorite())
+        score += favoriteScore;
+
+    return score;
+}
+
+// Finds the words of the label that the filter parts match, the way the search index matched
+// the folded tokens of the contact.
+QVector<int> SeasideFilteredModel::matchRanges(const QString &label) const
+{
+    QVector<int> ranges;
+    if (m_filterParts.isEmpty())
+        return ranges;
+
+    int position = 0;
+    foreach (const QString &word, SeasideSearchIndex::splitWords(label)) {
+        const int start = label.indexOf(word, position);
+        if (start == -1)
+            continue;
+        position = start + word.length();
+
+        const QString folded(SeasideSearchIndex::foldString(word));
+        const QString keys(m_searchMode == KeypadSearch ? SeasideSearchIndex::keypadDigits(folded) : folded);
+
+        int matched = 0;
+        foreach (const QString &part, m_filterParts) {
+            if (keys.startsWith(part)) {
+                matched = qMax(matched, part.length());
+            } else if (m_searchMode == FuzzySearch) {
+                const int distance = SeasideSearchIndex::maximumDistance(part.length());
+                if (distance > 0 && SeasideSearchIndex::prefixDistance(part, folded, distance) <= distance)
+                    matched = qMax(matched, qMin(part.length(), folded.length()));
+            }
+        }
+        if (matched == 0)
+            continue;
+
+        // Folding may have decomposed characters of the word, so find the length of
+        // the word that the matched part of the folded word came from.
+        int length = qMin(matched, word.length());
+        if (folded.length() != word.length()) {
+            length = word.length();
+            for (int i = 1; i < word.length(); ++i) {
+                if (SeasideSearchIndex::foldString(word.left(i)).length() >= matched) {
+                    length = i;
+                    break;
+                }
+            }
+        }
+
+        ranges.append(start);
+        ranges.append(length);
+    }
+    return ranges;
+}
+
+// The matched spans of the displayed rows change with the pattern. The rows notified are those
+// whose spans were read, since only their delegates can be showing them.
+void SeasideFilteredModel::resetMatchRanges()
+{
+    if (m_matchRanges.isEmpty())
+        return;
+
+    int remaining = m_matchRanges.count();
+    int first = -1;
+    int last = -1;
+    for (int row = 0; row < m_contactIds->count() && remaining > 0; ++row) {
+        SeasideCache::CacheItem *item = SeasideCache::existingItem(m_contactIds->at(row));
+        if (!item || !m_matchRanges.contains(item->iid))
+            continue;
+        --remaining;
+
+        if (row != last + 1 || first == -1) {
+            if (first != -1)
+                notifyDataChanged(first, last, QVector<int>() << MatchRangesRole);
+            first = row;
+        }
+        last = row;
+    }
+
+    m_matchRanges.clear();
+
+    if (first != -1)
+        notifyDataChanged(first, last, QVector<int>() << MatchRangesRole);
+}
+
+// Rearranges the filtered rows into the given order by removing, moving and inserting rows,
+// so that views keep the state of the rows that remain.
+void SeasideFilteredModel::publishOrder(const QVector<ContactIdType> &contactIds)
+{
+    m_contactIds = &m_filteredContactIds;
+
+    QSet<ContactIdType> wanted;
+    wanted.reserve(contactIds.count());
+    foreach (const ContactIdType &contactId, contactIds)
+        wanted.insert(contactId);
+
+    for (int row = 0; row < m_filteredContactIds.count();) {
+        if (wanted.contains(m_filteredContactIds.at(row))) {
+            ++row;
+            continue;
+        }
+
+        int count = 1;
+        while (row + count < m_filteredContactIds.count() && !wanted.contains(m_filteredContactIds.at(row + count)))
+            ++count;
+        removeRange(row, count);
+    }
+
+    QSet<ContactIdType> present;
+    present.reserve(m_filteredContactIds.count());
+    foreach (const ContactIdType &contactId, m_filteredContactIds)
+        present.insert(contactId);
+
+    // Every remaining row is wanted, so each is either in place or further down
+    int moves = 0;
+    for (int row = 0; row < contactIds.count();) {
+        const ContactIdType &contactId(contactIds.at(row));
+        if (row < m_filteredContactIds.count() && m_filteredContactIds.at(row) == contactId) {
+            ++row;
+            continue;
+        }
+
+        if (!present.contains(contactId)) {
+            int count = 1;
+            while (row + count < contactIds.count() && !present.contains(contactIds.at(row + count)))
+                ++count;
+            insertRange(row, count, contactIds, row);
+            row += count;
+            continue;
+        }
+
+        if (moves++ == maxMovedRows) {
+            // Too much has changed for moves to be worthwhile
+            beginResetModel();
+            m_filteredContactIds = contactIds;
+            endResetModel();
+            return;
+        }
+
+        const int from = m_filteredContactIds.indexOf(contactId, row + 1);
+        beginMoveRows(QModelIndex(), from, from, QModelIndex(), row);
+        m_filteredContactIds.remove(from);
+        m_filteredContactIds.insert(row, contactId);
+        endMoveRows();
+        ++row;
+    }
 }
 
-void SeasideFilteredModel::removeRange(int index, int count)
+// Reverts to a subset of a previous result, evaluating only the contacts in that result.
+void SeasideFilteredModel::restoreIndex(const QVector<ContactIdType> &candidates)
 {
-    beginRemoveRows(QModelIndex(), index, index + count - 1);
-    m_filteredContactIds.remove(index, count);
-    endRemoveRows();
+    if (startFilterJob(candidates))
+        return;
+
+    prepareIndexMatches();
+    const QBitArray matches(matchCandidates(candidates));
+    releaseIndexMatches();
+
+    applyMatches(candidates, matches);
 }
 
-void SeasideFilteredModel::refineIndex()
+// Updates the filtered list to contain the matching candidates: both the filtered list and the
+// candidates are in reference order and the filtered list is a subset of the candidates, so
+// the changes can be found in a single pass.
+void SeasideFilteredModel::applyMatches(const QVector<ContactIdType> &candidates, const QBitArray &matches)
 {
-    // The filtered list is a guaranteed sub-set of the current list, so just scan through
-    // and remove items that don't match the filter.
-    for (int i = 0; i < m_filteredContactIds.count();) {
-        int count = 0;
-        for (; i + count < m_filteredContactIds.count(); ++count) {
-            if (filterId(m_filteredContactIds.at(i + count)))
-                break;
+    // The candidate index of each filtered row
+    QVector<int> positions;
+    positions.reserve(m_filteredContactIds.count());
+    for (int i = 0, row = 0; i < candidates.count() && row < m_filteredContactIds.count(); ++i) {
+        if (m_filteredContactIds.at(row) == candidates.at(i)) {
+            positions.append(i);
+            ++row;
         }
+    }
 
+    int row = 0;
+    int p = 0;
+    for (int i = 0; ; ) {
+        // Remove rows that no longer match as soon as they are reached
+        int count = 0;
+        while (p + count < positions.count() && !matches.testBit(positions.at(p + count)))
+            ++count;
         if (count > 0) {
-            beginRemoveRows(QModelIndex(), i, i + count - 1);
-            m_filteredContactIds.remove(i, count);
-            endRemoveRows();
-        } else {
+            removeRange(row, count);
+            p += count;
+            continue;
+        }
+
+        if (i == candidates.count())
+            break;
+
+        if (p < positions.count() && positions.at(p) == i) {
+            ++row;
+            ++p;
+            ++i;
+        } else if (!matches.testBit(i)) {
             ++i;
+        } else {
+            count = 1;
+            while (i + count < candidates.count() && matches.testBit(i + count)
+                    && !(p < positions.count() && positions.at(p) == i + count)) {
+                ++count;
+            }
+            insertRange(row, count, candidates, i);
+            row += count;
+            i += count;
         }
     }
 }
 
-void SeasideFilteredModel::updateIndex()
+bool SeasideFilteredModel::isSubsequence(const QVector<ContactIdType> &values, const QVector<ContactIdType> &sequence)
 {
-    synchronizeFilteredList(this, m_filteredContactIds, *m_referenceContactIds);
+    int i = 0;
+    for (int j = 0; i < values.count() && j < sequence.count(); ++j) {
+        if (values.at(i) == sequence.at(j))
+            ++i;
+    }
+    return i == values.count();
 }
 
 void SeasideFilteredModel::populateIndex()
 {
+    if (startFilterJob(*m_referenceContactIds)) {
+        // The rows will be inserted when the job completes
+        m_contactIds = &m_filteredContactIds;
+        return;
+    }
+
+    const QBitArray matches(referenceMatches());
+
     // The filtered list is empty, so just scan through the reference list and append any
     // items that match the filter.
-    for (int i = 0; i < m_referenceContactIds->count(); ++i) {
-        if (filterId(m_referenceContactIds->at(i)))
+    for (int i = 0; i < matches.count(); ++i) {
+        if (matches.testBit(i))
             m_filteredContactIds.append(m_referenceContactIds->at(i));
     }
+
     if (!m_filteredContactIds.isEmpty())
         beginInsertRows(QModelIndex(), 0, m_filteredContactIds.count() - 1);
 
@@ -421,6 +1842,105 @@ void SeasideFilteredModel::populateIndex()
     }
 }
 
+// Matches the filter words against the candidates on a worker thread, if the model is
+// asynchronous. The filtered list is left untouched until the job completes, when the changes
+// the job found are made to it.
+bool SeasideFilteredModel::startFilterJob(const QVector<ContactIdType> &candidates)
+{
+    // Matching the name group or a query needs the cache and the search index, which can only
+    // be used on this thread.
+    if (!m_asynchronous || m_filterParts.isEmpty() || m_searchByFirstNameCharacter || !m_query.isEmpty())
+        return false;
+
+    if (m_jobContactsIds != m_referenceContactIds) {
+        // Copying the contacts costs a reference count each; they are tokenized by the jobs
+        m_jobContacts.clear();
+        m_jobContacts.resize(m_referenceContactIds->count());
+        updateJobContacts(0, m_jobContacts.count() - 1);
+        m_jobContactsIds = m_referenceContactIds;
+    }
+
+    // Everything the job reads is an implicitly shared copy
+    FilterJob job;
+    job.generation = m_filterGeneration->fetchAndAddOrdered(1) + 1;
+    job.currentGeneration = m_filterGeneration;
+    job.parts = m_filterParts;
+    job.number = m_filterNumber;
+    job.searchMode = m_searchMode;
+    job.requiredProperty = m_requiredProperty;
+    job.allCandidates = &candidates == m_referenceContactIds;
+    if (!job.allCandidates)
+        job.candidates = candidates;
+    job.revision = m_jobRevision;
+    job.contacts = m_jobContacts;
+    job.referenceContactIds = *m_referenceContactIds;
+    job.filteredContactIds = m_filteredContactIds;
+
+    m_filterPending = true;
+    m_filterWatcher->setFuture(QtConcurrent::run(&SeasideFilteredModel::matchFilterJob, job));
+    return true;
+}
+
+void SeasideFilteredModel::cancelFilterJob()
+{
+    // Any job still running will see the change of generation and stop early
+    if (m_filterPending) {
+        m_filterPending = false;
+        m_filterGeneration->fetchAndAddOrdered(1);
+    }
+}
+
+void SeasideFilteredModel::filterJobFinished()
+{
+    if (!m_filterPending || m_filterWatcher->future().resultCount() == 0)
+        return;
+
+    const FilterResult result(m_filterWatcher->result());
+    if (result.generation != currentGeneration(*m_filterGeneration))
+        return;
+
+    m_filterPending = false;
+
+    // Keep the tokens the job found, unless the contacts have changed since it started
+    if (result.revision == m_jobRevision)
+        m_jobContacts = result.contacts;
+
+    if (!(result.filteredContactIds == m_filteredContactIds)) {
+        // The rows have changed since the job started, so its changes no longer apply
+        startFilterJob(*m_referenceContactIds);
+        return;
+    }
+
+    const int prevCount = rowCount();
+
+    foreach (const FilterEdit &edit, result.edits) {
+        if (edit.contactIds.isEmpty()) {
+            removeRange(edit.row, edit.count);
+        } else {
+            insertRange(edit.row, edit.count, edit.contactIds, 0);
+        }
+    }
+
+    if (rowCount() != prevCount)
+        emit countChanged();
+}
+
+// Copies the details of rows begin..end of the reference list for filter jobs, which find their
+// tokens again the next time they are matched.
+void SeasideFilteredModel::updateJobContacts(int begin, int end)
+{
+    for (int i = begin; i <= end; ++i) {
+        JobContact contact;
+        contact.contactId = m_referenceContactIds->at(i);
+        if (SeasideCache::CacheItem *item = SeasideCache::existingItem(contact.contactId)) {
+            contact.statusFlags = item->statusFlags;
+            contact.contact = item->contact;
+        }
+        m_jobContacts[i] = contact;
+    }
+    ++m_jobRevision;
+}
+
 QVariantMap SeasideFilteredModel::get(int row) const
 {
     SeasideCache::CacheItem *cacheItem = SeasideCache::existingItem(m_contactIds->at(row));
@@ -441,6 +1961,7 @@ QVariantMap SeasideFilteredModel::get(int row) const
     m.insert(emailAddressesRole, data(cacheItem, EmailAddressesRole));
     m.insert(accountUrisRole, data(cacheItem, AccountUrisRole));
     m.insert(accountPathsRole, data(cacheItem, AccountPathsRole));
+    m.insert(matchRangesRole, data(cacheItem, MatchRangesRole));
     return m;
 }
 
@@ -453,6 +1974,40 @@ QVariant SeasideFilteredModel::get(int row, int role) const
     return data(cacheItem, role);
 }
 
+// Returns a list for each row of the range, holding the values of the named roles in order.
+// The names are resolved once for the whole range, and only the requested roles are read.
+QVariantList SeasideFilteredModel::getRange(int start, int count, const QStringList &roles) const
+{
+    QVariantList rows;
+
+    start = qMax(start, 0);
+    count = qMin(count, m_contactIds->count() - start);
+    if (count <= 0)
+        return rows;
+
+    const QHash<int, QByteArray> names(roleNames());
+    QVector<int> roleIds;
+    roleIds.reserve(roles.count());
+    foreach (const QString &name, roles) {
+        const int role = names.key(name.toUtf8(), -1);
+        if (role == -1)
+            qWarning() << "Invalid role requested:" << name;
+        roleIds.append(role);
+    }
+
+    rows.reserve(count);
+    for (int row = start; row < start + count; ++row) {
+        SeasideCache::CacheItem *cacheItem = SeasideCache::existingItem(m_contactIds->at(row));
+
+        QVariantList values;
+        values.reserve(roleIds.count());
+        foreach (int role, roleIds)
+            values.append(cacheItem && role != -1 ? data(cacheItem, role) : QVariant());
+        rows.append(QVariant(values));
+    }
+    return rows;
+}
+
 bool SeasideFilteredModel::savePerson(SeasidePerson *person)
 {
     return SeasideCache::saveContact(person->contact());
@@ -507,6 +2062,42 @@ int SeasideFilteredModel::rowCount(const QModelIndex &parent) const
             : 0;
 }
 
+void SeasideFilteredModel::fetchMoreResults()
+{
+    if (!m_moreResults)
+        return;
+
+    const int prevCount = rowCount();
+    m_resultLimit += m_maxResults;
+
+    if (m_ranked) {
+        rankIndex();
+    } else {
+        // Continue the scan from the first match beyond the previous limit
+        const QVector<ContactIdType> &reference(*m_referenceContactIds);
+
+        prepareIndexMatches();
+        QVector<ContactIdType> contactIds;
+        int i = m_scanPosition;
+        for ( ; i < reference.count(); ++i) {
+            if (!filterValue(reference.at(i)))
+                continue;
+            if (m_filteredContactIds.count() + contactIds.count() == m_resultLimit)
+                break;
+            contactIds.append(reference.at(i));
+        }
+        releaseIndexMatches();
+
+        m_scanPosition = i;
+        if (!contactIds.isEmpty())
+            insertRange(m_filteredContactIds.count(), contactIds.count(), contactIds, 0);
+        setMoreResults(i < reference.count());
+    }
+
+    if (rowCount() != prevCount)
+        emit countChanged();
+}
+
 QVariant SeasideFilteredModel::data(const QModelIndex &index, int role) const
 {
     if (!index.isValid())
@@ -521,49 +2112,34 @@ QVariant SeasideFilteredModel::data(const QModelIndex &index, int role) const
 
 QVariant SeasideFilteredModel::data(SeasideCache::CacheItem *cacheItem, int role) const
 {
-    const QContact &contact = cacheItem->contact;
+    if (role < FirstNameRole || role > AccountPathsRole || !(keptRoles & (1u << (role - FirstNameRole))))
+        return roleValue(cacheItem, role);
+
+    RoleValues *values = static_cast<RoleValues *>(cacheItem->listener(&roleValuesKey));
+    if (!values) {
+        values = new RoleValues(cacheItem);
+        cacheItem->appendListener(values, &roleValuesKey);
+    }
+    if (values->contactState != cacheItem->contactState) {
+        // Completion may have added details without the item being reported as updated
+        values->valid = 0;
+        values->contactState = cacheItem->contactState;
+    }
+
+    const int index = role - FirstNameRole;
+    if (!(values->valid & (1u << index))) {
+        values->values[index] = roleValue(cacheItem, role);
+        values->valid |= (1u << index);
+    }
+    return values->values[index];
+}
 
+QVariant SeasideFilteredModel::roleValue(SeasideCache::CacheItem *cacheItem, int role) const
+{
     if (role == ContactIdRole) {
         return cacheItem->iid;
-    } else if (role == FirstNameRole || role == LastNameRole) {
-        QContactName name = contact.detail<QContactName>();
-        return role == FirstNameRole
-                ? name.firstName()
-                : name.lastName();
-    } else if (role == FavoriteRole) {
-        return contact.detail<QContactFavorite>().isFavorite();
-    } else if (role == AvatarRole || role == AvatarUrlRole) {
-        QUrl avatarUrl = contact.detail<QContactAvatar>().imageUrl();
-        if (role == AvatarUrlRole || !avatarUrl.isEmpty()) {
-            return avatarUrl;
-        }
-        // Return the default avatar path for when no avatar URL is available
-        return QUrl(QLatin1String("image://theme/icon-m-telephony-contact-avatar"));
-    } else if (role == GlobalPresenceStateRole) {
-        QContactGlobalPresence presence = contact.detail<QContactGlobalPresence>();
-        return presence.isEmpty()
-                ? QContactPresence::PresenceUnknown
-                : presence.presenceState();
-    } else if (role == PhoneNumbersRole || role == EmailAddressesRole || role == AccountUrisRole || role == AccountPathsRole) {
-        QStringList rv;
-        if (role == PhoneNumbersRole) {
-            foreach (const QContactPhoneNumber &number, contact.details<QContactPhoneNumber>()) {
-                rv.append(number.number());
-            }
-        } else if (role == EmailAddressesRole) {
-            foreach (const QContactEmailAddress &address, contact.details<QContactEmailAddress>()) {
-                rv.append(address.emailAddress());
-            }
-        } else if (role == AccountPathsRole){
-            foreach (const QContactOnlineAccount &account, contact.details<QContactOnlineAccount>()) {
-                rv.append(account.value<QString>(QContactOnlineAccount__FieldAccountPath));
-            }
-        } else {
-            foreach (const QContactOnlineAccount &account, contact.details<QContactOnlineAccount>()) {
-                rv.append(account.accountUri());
-            }
-        }
-        return rv;
+    } else if (role >= FirstNameRole && role <= AccountPathsRole && role != SectionBucketRole) {
+        return contactValue(cacheItem->contact, role);
     } else if (role == Qt::DisplayRole || role == SectionBucketRole) {
         if (SeasidePerson *person = static_cast<SeasidePerson *>(cacheItem->itemData)) {
             // If we have a person instance, prefer to use that
@@ -574,6 +2150,21 @@ QVariant SeasideFilteredModel::data(SeasideCache::CacheItem *cacheItem, int role
         // Avoid creating a Person instance for as long as possible.
         SeasideCache::ensureCompletion(cacheItem);
         return QVariant::fromValue(personFromItem(cacheItem));
+    } else if (role == MatchRangesRole) {
+        QHash<quint32, QVector<int> >::iterator it = m_matchRanges.find(cacheItem->iid);
+        if (it == m_matchRanges.end()) {
+            const QString label(data(cacheItem, Qt::DisplayRole).toString());
+            it = m_matchRanges.insert(cacheItem->iid, matchRanges(label));
+        }
+
+        QVariantList rv;
+        for (int i = 0; i + 1 < it->count(); i += 2) {
+            QVariantMap range;
+            range.insert(matchStart, it->at(i));
+            range.insert(matchLength, it->at(i + 1));
+            rv.append(range);
+        }
+        return rv;
     } else {
         qWarning() << "Invalid role requested:" << role;
     }
@@ -583,6 +2174,19 @@ QVariant SeasideFilteredModel::data(SeasideCache::CacheItem *cacheItem, int role
 
 void SeasideFilteredModel::sourceAboutToRemoveItems(int begin, int end)
 {
+    m_referenceRowsContactIds = 0;
+
+    if (m_jobContactsIds == m_referenceContactIds) {
+        m_jobContacts.remove(begin, end - begin + 1);
+        ++m_jobRevision;
+    }
+
+    if (m_propertyRowsContactIds == m_referenceContactIds) {
+        removeBits(&m_accountUriRows, begin, end - begin + 1);
+        removeBits(&m_phoneNumberRows, begin, end - begin + 1);
+        removeBits(&m_emailAddressRows, begin, end - begin + 1);
+    }
+
     if (!isFiltered()) {
         beginRemoveRows(QModelIndex(), begin, end);
     }
@@ -590,6 +2194,12 @@ void SeasideFilteredModel::sourceAboutToRemoveItems(int begin, int end)
 
 void SeasideFilteredModel::sourceItemsRemoved()
 {
+    m_filterHistory.clear();
+
+    // A job in progress may have been given contacts that no longer exist
+    if (m_filterPending)
+        startFilterJob(*m_referenceContactIds);
+
     if (!isFiltered()) {
         endRemoveRows();
         emit countChanged();
@@ -598,6 +2208,8 @@ void SeasideFilteredModel::sourceItemsRemoved()
 
 void SeasideFilteredModel::sourceAboutToInsertItems(int begin, int end)
 {
+    m_referenceRowsContactIds = 0;
+
     if (!isFiltered()) {
         beginInsertRows(QModelIndex(), begin, end);
     }
@@ -605,8 +2217,26 @@ void SeasideFilteredModel::sourceAboutToInsertItems(int begin, int end)
 
 void SeasideFilteredModel::sourceItemsInserted(int begin, int end)
 {
-    Q_UNUSED(begin)
-    Q_UNUSED(end)
+    // Keep the search index covering the reference list, once it has been built
+    if (m_indexedContactIds == m_referenceContactIds)
+        m_searchIndex->insertItems(*m_referenceContactIds, begin, end);
+
+    if (m_propertyRowsContactIds == m_referenceContactIds) {
+        insertBits(&m_accountUriRows, begin, end - begin + 1);
+        insertBits(&m_phoneNumberRows, begin, end - begin + 1);
+        insertBits(&m_emailAddressRows, begin, end - begin + 1);
+        updatePropertyRows(begin, end);
+    }
+
+    if (m_jobContactsIds == m_referenceContactIds) {
+        m_jobContacts.insert(begin, end - begin + 1, JobContact());
+        updateJobContacts(begin, end);
+    }
+
+    m_filterHistory.clear();
+
+    if (m_filterPending)
+        startFilterJob(*m_referenceContactIds);
 
     if (!isFiltered()) {
         endInsertRows();
@@ -614,53 +2244,189 @@ void SeasideFilteredModel::sourceItemsInserted(int begin, int end)
     }
 }
 
+// Finds the roles that changed in the last update of the items of the reference rows, from the
+// values each item keeps. Returns false if none changed; the roles are left empty if any may have.
+// The changes of an update are consumed once notified, so a later notification of the rows
+// without a new update presumes every role changed rather than repeating them.
+bool SeasideFilteredModel::changedRoles(int begin, int end, QVector<int> *roles)
+{
+    quint32 changed = 0;
+    bool labelChanged = false;
+    bool unknown = false;
+    quint64 serial = m_roleSerial;
+
+    for (int i = begin; i <= end; ++i) {
+        SeasideCache::CacheItem *item = SeasideCache::existingItem(m_referenceContactIds->at(i));
+        if (!item)
+            continue;
+
+        const RoleValues *values = static_cast<RoleValues *>(item->listener(&roleValuesKey));
+        if (!values || values->contactState != item->contactState || values->serial <= m_roleSerial) {
+            // No values were read before the change, the item was completed without them, or
+            // their changes were already notified
+            unknown = true;
+            m_matchRanges.remove(item->iid);
+        } else {
+            serial = qMax(serial, values->serial);
+            changed |= values->changed;
+            if (values->labelChanged) {
+                labelChanged = true;
+                m_matchRanges.remove(item->iid);
+            }
+        }
+    }
+
+    m_roleSerial = serial;
+
+    if (unknown)
+        return true;
+
+    if (labelChanged)
+        *roles << Qt::DisplayRole << SectionBucketRole << MatchRangesRole;
+    for (int i = 0; i < roleValueCount; ++i) {
+        if (changed & (1u << i))
+            roles->append(FirstNameRole + i);
+    }
+    return !roles->isEmpty();
+}
+
+void SeasideFilteredModel::notifyDataChanged(int first, int last, const QVector<int> &roles)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    emit dataChanged(createIndex(first, 0), createIndex(last, 0), roles);
+#else
+    Q_UNUSED(roles)
+    emit dataChanged(createIndex(first, 0), createIndex(last, 0));
+#endif
+}
+
 void SeasideFilteredModel::sourceDataChanged(int begin, int end)
 {
+    QVector<int> roles;
+    const bool changed = changedRoles(begin, end, &roles);
+
+    if (m_propertyRowsContactIds == m_referenceContactIds)
+        updatePropertyRows(begin, end);
+    if (m_jobContactsIds == m_referenceContactIds)
+        updateJobContacts(begin, end);
+
     if (!isFiltered()) {
-        emit dataChanged(createIndex(begin, 0), createIndex(end, 0));
+        if (changed)
+            notifyDataChanged(begin, end, roles);
+    } else if (m_ranked || m_limited) {
+        // The changes may alter the relevance of the items as well as whether they match, so
+        // each is moved to or from the row found for it by bisection
+        m_filterHistory.clear();
+
+        bool updated = true;
+        for (int i = begin; i <= end && updated; ++i) {
+            if (m_ranked) {
+                updated = updateRankedRow(i, changed, roles);
+            } else {
+                updateLimitedRow(i, changed, roles);
+            }
+        }
+        if (updated)
+            return;
+
+        // A match beyond the limit may now be more relevant than the last row
+        rankIndex();
+
+        QSet<ContactIdType> changedIds;
+        for (int i = begin; i <= end; ++i)
+            changedIds.insert(m_referenceContactIds->at(i));
+
+        int changedRow = -1;
+        for (int row = 0; row <= m_filteredContactIds.count(); ++row) {
+            if (row < m_filteredContactIds.count() && changedIds.contains(m_filteredContactIds.at(row))) {
+                if (changedRow == -1)
+                    changedRow = row;
+            } else if (changedRow != -1) {
+                if (changed)
+                    notifyDataChanged(changedRow, row - 1, roles);
+                changedRow = -1;
+            }
+        }
     } else {
         // the items inserted/removed notifications arrive sequentially.  All bets are off
         // for dataChanged so we want to reset the progressive indexes back to the beginning.
         m_referenceIndex = 0;
         m_filterIndex = 0;
 
-        // This could be optimised to group multiple changes together, but as of right
-        // now begin and end are always the same so theres no point.
+        // Previous results may no longer be valid for the changed items.
+        m_filterHistory.clear();
+
+        const QVector<ContactIdType> &reference(*m_referenceContactIds);
+
+        QBitArray matches(end - begin + 1);
         for (int i = begin; i <= end; ++i) {
-            const int f = m_filteredContactIds.indexOf(m_referenceContactIds->at(i));
-            const bool match = filterId(m_referenceContactIds->at(i));
-
-            if (f < 0 && match) {
-                // The contact is not in the filtered list but is a match to the filter; find the
-                // correct position and insert it.
-                int r = 0;
-                int f = 0;
-                for (; f < m_filteredContactIds.count(); ++f) {
-                    r = m_referenceContactIds->indexOf(m_filteredContactIds.at(f), r);
-                    if (r > begin)
+            if (filterId(reference.at(i)))
+                matches.setBit(i - begin);
+        }
+
+        // The filtered rows of the changed items are contiguous, starting from the first
+        // filtered row at or after the first changed item, so merge the two ranges.
+        int row = filteredLowerBound(begin);
+        int changedRow = -1;
+        for (int i = begin; i <= end;) {
+            const bool present = row < m_filteredContactIds.count() && m_filteredContactIds.at(row) == reference.at(i);
+            const bool match = matches.testBit(i - begin);
+
+            if (present && match) {
+                if (changedRow == -1)
+                    changedRow = row;
+                ++row;
+                ++i;
+                continue;
+            }
+
+            if (changedRow != -1) {
+                if (changed)
+                    notifyDataChanged(changedRow, row - 1, roles);
+                changedRow = -1;
+            }
+
+            int count = 1;
+            if (present) {
+                // The contacts are in the filtered set but no longer match; remove them.
+                for (; i + count <= end && row + count < m_filteredContactIds.count(); ++count) {
+                    if (m_filteredContactIds.at(row + count) != reference.at(i + count)
+                            || matches.testBit(i + count - begin)) {
+                        break;
+                    }
+                }
+                removeRange(row, count);
+            } else if (match) {
+                // The contacts are not in the filtered set but now match; insert them here.
+                for (; i + count <= end; ++count) {
+                    if ((row < m_filteredContactIds.count() && m_filteredContactIds.at(row) == reference.at(i + count))
+                            || !matches.testBit(i + count - begin)) {
                         break;
+                    }
                 }
-                beginInsertRows(QModelIndex(), f, f);
-                m_filteredContactIds.insert(f, m_referenceContactIds->at(i));
-                endInsertRows();
-            } else if (f >= 0 && !match) {
-                // The contact is in the filtered set but is not a match to the filter; remove it.
-                beginRemoveRows(QModelIndex(), f, f);
-                m_filteredContactIds.remove(f);
-                endRemoveRows();
-            } else if (f >= 0) {
-                const QModelIndex index = createIndex(f, 0);
-                emit dataChanged(index, index);
+                insertRange(row, count, reference, i);
+                row += count;
             }
+            i += count;
         }
+
+        if (changed && changedRow != -1)
+            notifyDataChanged(changedRow, row - 1, roles);
+
+        // A job in progress may have matched the old details
+        if (m_filterPending)
+            startFilterJob(*m_referenceContactIds);
     }
 }
 
 void SeasideFilteredModel::sourceItemsChanged()
 {
+    m_jobContactsIds = 0;
+
     if (isFiltered()) {
         const int prevCount = rowCount();
 
+        m_filterHistory.clear();
         updateIndex();
 
         if (rowCount() != prevCount) {
@@ -674,14 +2440,133 @@ void SeasideFilteredModel::makePopulated()
     emit populatedChanged();
 }
 
+// The labels are read from the cache, which has already relabelled its items, so only the
+// notifications are spread out. The visible rows are notified at once, and the rows either side
+// in batches once the event loop is idle, nearest first.
 void SeasideFilteredModel::updateDisplayLabelOrder()
 {
-    if (!m_contactIds->isEmpty())
-        emit dataChanged(createIndex(0, 0), createIndex(0, m_contactIds->count() - 1));
+    m_matchRanges.clear();
+    m_relabelRows.clear();
+
+    m_relabelRoles = QVector<int>() << Qt::DisplayRole << SectionBucketRole;
+    if (!m_filterParts.isEmpty())
+        m_relabelRoles.append(MatchRangesRole);
+
+    const int count = m_contactIds->count();
+    int first = qMax(m_visibleFirst, 0);
+    int last = qMin(m_visibleLast, count - 1);
+    if (first > last) {
+        // Without visible rows reported by prefetch(), assume the view is at the top
+        first = 0;
+        last = qMin(relabelBatchSize, count) - 1;
+    }
+
+    if (first <= last)
+        notifyDataChanged(first, last, m_relabelRoles);
+
+    // Queue blocks of rows alternately after and before the visible rows
+    for (int after = last + 1, before = first; after < count || before > 0;) {
+        for (const int end = qMin(after + relabelBatchSize, count); after < end; ++after)
+            m_relabelRows.append(qMakePair(after, m_contactIds->at(after)));
+        for (int row = qMax(before - relabelBatchSize, 0); row < before; ++row)
+            m_relabelRows.append(qMakePair(row, m_contactIds->at(row)));
+        before = qMax(before - relabelBatchSize, 0);
+    }
+
+    if (m_relabelRows.isEmpty()) {
+        m_relabelTimer.stop();
+    } else if (!m_relabelTimer.isActive()) {
+        m_relabelTimer.start(0);
+    }
 
     emit displayLabelOrderChanged();
 }
 
+void SeasideFilteredModel::relabelBatch()
+{
+    int first = -1;
+    int last = -1;
+    for (int i = 0; i < relabelBatchSize && !m_relabelRows.isEmpty(); ++i) {
+        const QPair<int, ContactIdType> next(m_relabelRows.takeFirst());
+
+        // Rows may have been inserted or removed since the row was queued
+        int row = next.first;
+        if (row >= m_contactIds->count() || m_contactIds->at(row) != next.second)
+            row = m_contactIds->indexOf(next.second);
+        if (row == -1)
+            continue;
+
+        if (row != last + 1 || first == -1) {
+            if (first != -1)
+                notifyDataChanged(first, last, m_relabelRoles);
+            first = row;
+        }
+        last = row;
+    }
+    if (first != -1)
+        notifyDataChanged(first, last, m_relabelRoles);
+
+    if (!m_relabelRows.isEmpty())
+        m_relabelTimer.start(0);
+}
+
+// The visible rows are requested together, so that the cache can fetch them in a single
+// request. The rows either side follow in batches once the event loop is idle, and are
+// forgotten if the visible rows change before their turn comes.
+void SeasideFilteredModel::prefetch(int firstVisible, int lastVisible, int lookahead)
+{
+    m_prefetchIds.clear();
+
+    // Kept to relabel the visible rows first
+    m_visibleFirst = firstVisible;
+    m_visibleLast = lastVisible;
+
+    const int count = m_contactIds->count();
+    firstVisible = qMax(firstVisible, 0);
+    lastVisible = qMin(lastVisible, count - 1);
+    if (firstVisible > lastVisible) {
+        m_prefetchTimer.stop();
+        return;
+    }
+
+    for (int row = firstVisible; row <= lastVisible; ++row) {
+        SeasideCache::CacheItem *item = SeasideCache::existingItem(m_contactIds->at(row));
+        if (item && item->contactState < SeasideCache::ContactRequested)
+            SeasideCache::ensureCompletion(item);
+    }
+
+    // Alternate between the rows after and before the visible rows, nearest first
+    for (int distance = 1; distance <= lookahead; ++distance) {
+        const int rows[] = { lastVisible + distance, firstVisible - distance };
+        for (int i = 0; i < 2; ++i) {
+            if (rows[i] < 0 || rows[i] >= count)
+                continue;
+
+            SeasideCache::CacheItem *item = SeasideCache::existingItem(m_contactIds->at(rows[i]));
+            if (item && item->contactState < SeasideCache::ContactRequested)
+                m_prefetchIds.append(m_contactIds->at(rows[i]));
+        }
+    }
+
+    if (m_prefetchIds.isEmpty()) {
+        m_prefetchTimer.stop();
+    } else if (!m_prefetchTimer.isActive()) {
+        m_prefetchTimer.start(0);
+    }
+}
+
+void SeasideFilteredModel::prefetchBatch()
+{
+    for (int i = 0; i < prefetchBatchSize && !m_prefetchIds.isEmpty(); ++i) {
+        SeasideCache::CacheItem *item = SeasideCache::existingItem(m_prefetchIds.takeFirst());
+        if (item && item->contactState < SeasideCache::ContactRequested)
+            SeasideCache::ensureCompletion(item);
+    }
+
+    if (!m_prefetchIds.isEmpty())
+        m_prefetchTimer.start(0);
+}
+
 int SeasideFilteredModel::importContacts(const QString &path)
 {
     return SeasideCache::importContacts(path);
@@ -706,33 +2591,66 @@ SeasidePerson *SeasideFilteredModel::personFromItem(SeasideCache::CacheItem *ite
 
 bool SeasideFilteredModel::isFiltered() const
 {
-    return !m_filterPattern.isEmpty() || (m_requiredProperty != NoPropertyRequired);
+    return !m_filterPattern.isEmpty() || (m_requiredProperty != NoPropertyRequired) || !m_query.isEmpty();
+}
+
+bool SeasideFilteredModel::isRanking() const
+{
+    return m_sortOrder == RelevanceOrder && !m_filterParts.isEmpty() && !m_searchByFirstNameCharacter;
+}
+
+bool SeasideFilteredModel::isLimiting() const
+{
+    return m_maxResults > 0 && isFiltered();
 }
 
-void SeasideFilteredModel::updateFilters(const QString &pattern, int property)
+// Returns true if the filtered list is, or is to be, ranked or limited rather than holding
+// every match in reference order, which the incremental updates rely on.
+bool SeasideFilteredModel::isSelective() const
+{
+    return m_ranked || m_limited || isRanking() || isLimiting();
+}
+
+void SeasideFilteredModel::updateFilters(const QString &pattern, int property, bool notify)
 {
     if ((pattern == m_filterPattern) && (property == m_requiredProperty))
         return;
 
     const bool filtered = isFiltered();
-    const bool removeFilter = pattern.isEmpty() && property == NoPropertyRequired;
-    const bool refinement = (pattern == m_filterPattern || pattern.startsWith(m_filterPattern, Qt::CaseInsensitive)) &&
+    const bool removeFilter = pattern.isEmpty() && property == NoPropertyRequired && m_query.isEmpty();
+    const QString filterNumber(numberPattern(pattern));
+    const QStringList filterParts(patternParts(pattern));
+    // The results of an unfinished filter job can't be refined, and a longer fuzzy word
+    // tolerates more errors, so it may match contacts that the shorter word did not.
+    // Likewise once a number is long enough to be matched within phone numbers. Lengthening
+    // any of the words refines the filter, unless digits within numbers are being matched.
+    const bool wordRefinement = !m_searchByFirstNameCharacter && filterNumber.isEmpty() && m_filterNumber.isEmpty() &&
+                                refinesWords(filterParts, m_filterParts);
+    const bool refinement = !m_filterPending && m_searchMode != FuzzySearch &&
+                            (filterNumber.isEmpty() || !m_filterNumber.isEmpty()) &&
+                            (pattern == m_filterPattern || pattern.startsWith(m_filterPattern, Qt::CaseInsensitive) || wordRefinement) &&
                             (property == m_requiredProperty || m_requiredProperty == NoPropertyRequired);
 
     const int prevCount = rowCount();
+    const QString previousPattern(m_filterPattern);
+    const int previousProperty(m_requiredProperty);
+
+    if (removeFilter)
+        m_filterHistory.clear();
+
+    // Any job in progress is for the previous filter
+    cancelFilterJob();
+
+    // Results beyond the first page were only fetched for the previous filter
+    m_resultLimit = m_maxResults;
 
     bool changedPattern(false);
     bool changedProperty(false);
 
     if (m_filterPattern != pattern) {
         m_filterPattern = pattern;
-        m_filterParts = splitWords(m_filterPattern);
-#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
-        // Qt5 does not recognize '#' as a word
-        if (m_filterParts.isEmpty() && !pattern.isEmpty()) {
-            m_filterParts.append(pattern);
-        }
-#endif
+        m_filterParts = filterParts;
+        m_filterNumber = filterNumber;
         changedPattern = true;
     }
     if (m_requiredProperty != property) {
@@ -745,6 +2663,27 @@ void SeasideFilteredModel::updateFilters(const QString &pattern, int property)
         updateRegistration();
     }
 
+    updateFilteredContacts(filtered, removeFilter, refinement, previousPattern, previousProperty);
+
+    if (changedPattern) {
+        resetMatchRanges();
+    }
+    if (rowCount() != prevCount) {
+        emit countChanged();
+    }
+    if (changedPattern && notify) {
+        emit filterPatternChanged();
+    }
+    if (changedProperty && notify) {
+        emit requiredPropertyChanged();
+    }
+}
+
+// Brings the filtered list up to date with the changed filters, given whether the model was
+// filtered before the change, and whether the new filters refine the previous ones.
+void SeasideFilteredModel::updateFilteredContacts(bool filtered, bool removeFilter, bool refinement,
+                                                  const QString &previousPattern, int previousProperty)
+{
     m_referenceIndex = 0;
     m_filterIndex = 0;
 
@@ -752,15 +2691,28 @@ void SeasideFilteredModel::updateFilters(const QString &pattern, int property)
         m_effectiveFilterType = FilterAll;
         updateRegistration();
 
-        m_referenceContactIds = SeasideCache::contacts(SeasideCache::FilterAll);
-        populateIndex();
+        setReferenceContactIds(SeasideCache::contacts(SeasideCache::FilterAll));
+        if (isSelective()) {
+            updateIndex();
+        } else {
+            populateIndex();
+        }
     } else if (!filtered) {
         m_filteredContactIds = *m_referenceContactIds;
         m_contactIds = &m_filteredContactIds;
 
-        refineIndex();
+        if (isSelective()) {
+            updateIndex();
+        } else {
+            refineIndex();
+        }
+    } else if (!removeFilter && isSelective()) {
+        updateIndex();
     } else if (refinement) {
+        pushFilterSnapshot(previousPattern, previousProperty);
         refineIndex();
+    } else if (!removeFilter && m_searchMode != FuzzySearch && restoreFilterSnapshot()) {
+        // The new filter refines a previous one; only the previous results need evaluating.
     } else if (removeFilter && m_filterType == FilterNone) {
         m_effectiveFilterType = FilterNone;
         updateRegistration();
@@ -770,9 +2722,14 @@ void SeasideFilteredModel::updateFilters(const QString &pattern, int property)
             beginRemoveRows(QModelIndex(), 0, m_contactIds->count() - 1);
         }
 
-        m_referenceContactIds = SeasideCache::contacts(SeasideCache::FilterNone);
+        setReferenceContactIds(SeasideCache::contacts(SeasideCache::FilterNone));
         m_contactIds = m_referenceContactIds;
         m_filteredContactIds.clear();
+        releaseSharedMatches();
+        m_ranked = false;
+        m_limited = false;
+        m_relevance.clear();
+        setMoreResults(false);
 
         if (hadMatches) {
             endRemoveRows();
@@ -785,16 +2742,46 @@ void SeasideFilteredModel::updateFilters(const QString &pattern, int property)
             m_filteredContactIds.clear();
         }
     }
+}
 
-    if (rowCount() != prevCount) {
-        emit countChanged();
-    }
-    if (changedPattern) {
-        emit filterPatternChanged();
-    }
-    if (changedProperty) {
-        emit requiredPropertyChanged();
+void SeasideFilteredModel::pushFilterSnapshot(const QString &pattern, int property)
+{
+    if (m_filterHistory.count() == maxFilterHistory)
+        m_filterHistory.removeFirst();
+
+    FilterSnapshot snapshot;
+    snapshot.pattern = pattern;
+    snapshot.requiredProperty = property;
+    snapshot.contactIds = m_filteredContactIds;
+    m_filterHistory.append(snapshot);
+}
+
+bool SeasideFilteredModel::restoreFilterSnapshot()
+{
+    // Find the most refined previous filter that the current filter is a refinement of, such
+    // as a shorter pattern after deleting characters, or a sibling pattern after correcting one.
+    for (int i = m_filterHistory.count() - 1; i >= 0; --i) {
+        const FilterSnapshot &snapshot(m_filterHistory.at(i));
+        if (!m_filterPattern.startsWith(snapshot.pattern, Qt::CaseInsensitive))
+            continue;
+        if (snapshot.requiredProperty != NoPropertyRequired && snapshot.requiredProperty != m_requiredProperty)
+            continue;
+        if (!m_filterNumber.isEmpty() && numberPattern(snapshot.pattern).isEmpty())
+            continue;
+
+        const QVector<ContactIdType> candidates(snapshot.contactIds);
+
+        // Keep the snapshot only if it is an ancestor of the current filter
+        const bool ancestor = snapshot.pattern != m_filterPattern || snapshot.requiredProperty != m_requiredProperty;
+        while (m_filterHistory.count() > (ancestor ? i + 1 : i))
+            m_filterHistory.removeLast();
+
+        restoreIndex(candidates);
+        return true;
     }
+
+    m_filterHistory.clear();
+    return false;
 }
 
 void SeasideFilteredModel::updateRegistration()
@@ -32,15 +32,27 @@
 #ifndef SEASIDEFILTEREDMODEL_H
 #define SEASIDEFILTEREDMODEL_H
 
+#include "seasidequery.h"
+#include "seasidesearchindex.h"
+
 #include <seasidecache.h>
 
+#include <QAtomicInt>
+#include <QBitArray>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QSharedPointer>
 #include <QStringList>
+#include <QTimer>
 #include <QVector>
 
 #include <QContact>
 
 class SeasidePerson;
 
+template <typename T> class QFutureWatcher;
+
 USE_CONTACTS_NAMESPACE
 
 class SeasideFilteredModel : public SeasideCache::ListModel
@@ -51,9 +63,17 @@ class SeasideFilteredModel : public SeasideCache::ListModel
     Q_PROPERTY(DisplayLabelOrder displayLabelOrder READ displayLabelOrder WRITE setDisplayLabelOrder NOTIFY displayLabelOrderChanged)
     Q_PROPERTY(QString filterPattern READ filterPattern WRITE setFilterPattern NOTIFY filterPatternChanged)
     Q_PROPERTY(int requiredProperty READ requiredProperty WRITE setRequiredProperty NOTIFY requiredPropertyChanged)
+    Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged)
     Q_PROPERTY(bool searchByFirstNameCharacter READ searchByFirstNameCharacter WRITE setSearchByFirstNameCharacter NOTIFY searchByFirstNameCharacterChanged)
+    Q_PROPERTY(bool asynchronous READ isAsynchronous WRITE setAsynchronous NOTIFY asynchronousChanged)
+    Q_PROPERTY(bool parallel READ isParallel WRITE setParallel NOTIFY parallelChanged)
+    Q_PROPERTY(int filterDelay READ filterDelay WRITE setFilterDelay NOTIFY filterDelayChanged)
+    Q_PROPERTY(SearchMode searchMode READ searchMode WRITE setSearchMode NOTIFY searchModeChanged)
+    Q_PROPERTY(SortOrder sortOrder READ sortOrder WRITE setSortOrder NOTIFY sortOrderChanged)
+    Q_PROPERTY(int maxResults READ maxResults WRITE setMaxResults NOTIFY maxResultsChanged)
+    Q_PROPERTY(bool hasMoreResults READ hasMoreResults NOTIFY hasMoreResultsChanged)
     Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
-    Q_ENUMS(FilterType RequiredPropertyType DisplayLabelOrder)
+    Q_ENUMS(FilterType RequiredPropertyType DisplayLabelOrder SearchMode SortOrder)
 
 public:
     enum FilterType {
@@ -76,6 +96,17 @@ public:
         LastNameFirst = SeasideCache::LastNameFirst
     };
 
+    enum SearchMode {
+        PrefixSearch,
+        FuzzySearch,
+        KeypadSearch
+    };
+
+    enum SortOrder {
+        ReferenceOrder,
+        RelevanceOrder
+    };
+
     enum PeopleRoles {
         FirstNameRole = Qt::UserRole,
         LastNameRole,
@@ -89,7 +120,8 @@ public:
         EmailAddressesRole,
         AccountUrisRole,
         AccountPathsRole,
-        PersonRole
+        PersonRole,
+        MatchRangesRole
     };
 
     typedef SeasideCache::ContactIdType ContactIdType;
@@ -108,14 +140,44 @@ public:
     int requiredProperty() const;
     void setRequiredProperty(int type);
 
+    QString query() const;
+    void setQuery(const QString &query);
+
     bool searchByFirstNameCharacter() const;
     void setSearchByFirstNameCharacter(bool searchByFirstNameCharacter);
 
+    bool isAsynchronous() const;
+    void setAsynchronous(bool asynchronous);
+
+    bool isParallel() const;
+    void setParallel(bool parallel);
+
+    int filterDelay() const;
+    void setFilterDelay(int delay);
+
+    SearchMode searchMode() const;
+    void setSearchMode(SearchMode mode);
+
+    SortOrder sortOrder() const;
+    void setSortOrder(SortOrder order);
+
+    int maxResults() const;
+    void setMaxResults(int maxResults);
+
+    bool hasMoreResults() const;
+    // Extends the results by another maxResults matches. This is not done by fetchMore(), as
+    // views call that whenever they are scrolled to the end, which would lift the limit.
+    Q_INVOKABLE void fetchMoreResults();
+
     DisplayLabelOrder displayLabelOrder() const;
     void setDisplayLabelOrder(DisplayLabelOrder order);
 
     Q_INVOKABLE QVariantMap get(int row) const;
     Q_INVOKABLE QVariant get(int row, int role) const;
+    Q_INVOKABLE QVariantList getRange(int start, int count, const QStringList &roles) const;
+
+    // Requests the completion of the visible rows, and then of up to lookahead rows either side
+    Q_INVOKABLE void prefetch(int firstVisible, int lastVisible, int lookahead = 0);
 
     Q_INVOKABLE bool savePerson(SeasidePerson *person);
     Q_INVOKABLE SeasidePerson *personByRow(int row) const;
@@ -141,7 +203,7 @@ public:
     bool filterId(const ContactIdType &contactId) const;
 
     // For synchronizeLists()
-    bool filterValue(const ContactIdType &contactId) const { return filterId(contactId); }
+    bool filterValue(const ContactIdType &contactId) const;
     void insertRange(int index, int count, const QVector<ContactIdType> &source, int sourceIndex);
     void removeRange(int index, int count);
 
@@ -169,26 +231,167 @@ signals:
     void filterTypeChanged();
     void filterPatternChanged();
     void requiredPropertyChanged();
+    void queryChanged();
     void searchByFirstNameCharacterChanged();
+    void asynchronousChanged();
+    void parallelChanged();
+    void filterDelayChanged();
+    void searchModeChanged();
+    void sortOrderChanged();
+    void maxResultsChanged();
+    void hasMoreResultsChanged();
     void displayLabelOrderChanged();
     void countChanged();
 
+private slots:
+    void filterJobFinished();
+    void applyPendingFilters();
+    void prefetchBatch();
+    void relabelBatch();
+
 private:
+    struct FilterJob;
+    struct FilterAgent;
+
+    // The details of a contact of the reference list that filter jobs match against. The contact
+    // is an implicitly shared copy, so a job can read it while the cache updates its own.
+    struct JobContact
+    {
+        JobContact() : statusFlags(0), tokenized(false), keypadTokenized(false) {}
+
+        ContactIdType contactId;
+        quint64 statusFlags;
+        QContact contact;
+        // Found by the first job to match the contact
+        bool tokenized;
+        SeasideSearchIndex::Tokens tokens;
+        QStringList numbers;
+        bool keypadTokenized;
+        SeasideSearchIndex::Tokens keypadTokens;
+    };
+
+    // A change to the filtered list: the contacts inserted at a row, or if there are none,
+    // the number of rows removed from it
+    struct FilterEdit
+    {
+        int row;
+        int count;
+        QVector<ContactIdType> contactIds;
+    };
+
+    // The changes that bring the filtered list a job started with up to date with its filter
+    struct FilterResult
+    {
+        int generation;
+        QVector<ContactIdType> filteredContactIds;
+        QList<FilterEdit> edits;
+        // The contacts with the tokens the job found, as of a revision of the model's copy
+        int revision;
+        QVector<JobContact> contacts;
+    };
+
+    static FilterResult matchFilterJob(const FilterJob &job);
+
     void populateIndex();
     void refineIndex();
     void updateIndex();
+    void restoreIndex(const QVector<ContactIdType> &candidates);
+    void prepareIndexMatches();
+    QSet<quint32> termMatch(const QString &part);
+    void releaseIndexMatches();
+    bool sharedMatches(QBitArray *matches);
+    void shareMatches(const QBitArray &matches);
+    void releaseSharedMatches();
+    QBitArray referenceMatches();
+    QBitArray matchCandidates(const QVector<ContactIdType> &candidates);
+    QBitArray requiredPropertyRows();
+    void updatePropertyRows(int begin, int end);
+    void applyMatches(const QVector<ContactIdType> &candidates, const QBitArray &matches);
+    void setReferenceContactIds(const QVector<ContactIdType> *contactIds);
+    int referenceRow(const ContactIdType &contactId);
+    int filteredLowerBound(int referenceIndex);
+    static bool isSubsequence(const QVector<ContactIdType> &values, const QVector<ContactIdType> &sequence);
+    bool startFilterJob(const QVector<ContactIdType> &candidates);
+    void cancelFilterJob();
+    void updateJobContacts(int begin, int end);
     void updateContactData(const ContactIdType &contactId, FilterType filter);
     void updateRegistration();
 
     bool isFiltered() const;
-    void updateFilters(const QString &pattern, int property);
+    bool isRanking() const;
+    bool isLimiting() const;
+    bool isSelective() const;
+    void rankIndex();
+    void limitIndex();
+    int rankedLowerBound(int score, int referenceIndex, int skipRow);
+    bool updateRankedRow(int referenceIndex, bool changed, const QVector<int> &roles);
+    int findMatch(int from);
+    void updateLimitedRow(int referenceIndex, bool changed, const QVector<int> &roles);
+    void setMoreResults(bool moreResults);
+    void publishOrder(const QVector<ContactIdType> &contactIds);
+    int relevance(SeasideCache::CacheItem *item) const;
+    QVector<int> matchRanges(const QString &label) const;
+    void resetMatchRanges();
+    bool hasRequiredProperty(SeasideCache::CacheItem *item) const;
+    void setFilters(const QString &pattern, int property);
+    void updateFilters(const QString &pattern, int property, bool notify = true);
+    void updateFilteredContacts(bool filtered, bool removeFilter, bool refinement,
+                                const QString &previousPattern, int previousProperty);
+    void pushFilterSnapshot(const QString &pattern, int property);
+    bool restoreFilterSnapshot();
 
     SeasidePerson *personFromItem(SeasideCache::CacheItem *item) const;
+    QVariant roleValue(SeasideCache::CacheItem *item, int role) const;
+    bool changedRoles(int begin, int end, QVector<int> *roles);
+    void notifyDataChanged(int first, int last, const QVector<int> &roles);
+
+    // The results of a filter that the current filter is a refinement of
+    struct FilterSnapshot
+    {
+        QString pattern;
+        int requiredProperty;
+        QVector<ContactIdType> contactIds;
+    };
 
     QVector<ContactIdType> m_filteredContactIds;
     const QVector<ContactIdType> *m_contactIds;
     const QVector<ContactIdType> *m_referenceContactIds;
+    const QVector<ContactIdType> *m_indexedContactIds;
+    const QVector<ContactIdType> *m_propertyRowsContactIds;
+    // The rows of the reference list having each type of required property
+    QBitArray m_accountUriRows;
+    QBitArray m_phoneNumberRows;
+    QBitArray m_emailAddressRows;
+    const QVector<ContactIdType> *m_referenceRowsContactIds;
+    // The row of each contact in the reference list
+    QHash<ContactIdType, int> m_referenceRows;
+    SeasideSearchIndex *m_searchIndex;
+    QSet<quint32> m_indexMatches;
+    bool m_useIndexMatches;
+    // The matches of each word of the pattern, as of a generation of the search index
+    QHash<QString, QSet<quint32> > m_termMatches;
+    int m_termGeneration;
+    SearchMode m_termSearchMode;
+    // The filter whose matches of the reference list are shared with other models
+    SeasideSearchIndex::ResultKey m_resultKey;
+    bool m_resultShared;
     QStringList m_filterParts;
+    // The digits of a pattern that looks like a phone number, matched anywhere in the numbers
+    QString m_filterNumber;
+    // The structured query, matched in addition to the pattern and required property
+    SeasideQuery m_query;
+    // The start and length of each span of the display label matching the filter, by iid, for
+    // the rows whose spans have been read
+    mutable QHash<quint32, QVector<int> > m_matchRanges;
+    // The serial of the latest item update whose changed roles were notified
+    quint64 m_roleSerial;
+    QList<FilterSnapshot> m_filterHistory;
+    QFutureWatcher<FilterResult> *m_filterWatcher;
+    QSharedPointer<QAtomicInt> m_filterGeneration;
+    // The contacts of the reference list as filter jobs see them, changed in step with the list
+    QVector<JobContact> m_jobContacts;
+    const QVector<ContactIdType> *m_jobContactsIds;
+    int m_jobRevision;
     QString m_filterPattern;
     int m_filterIndex;
     int m_referenceIndex;
@@ -197,6 +400,37 @@ private:
     SeasideCache::FetchDataType m_fetchTypes;
     int m_requiredProperty;
     bool m_searchByFirstNameCharacter;
+    SearchMode m_searchMode;
+    SortOrder m_sortOrder;
+    // The filtered list is in relevance rather than reference order
+    bool m_ranked;
+    // The relevance each match was ranked with
+    QHash<ContactIdType, int> m_relevance;
+    int m_maxResults;
+    // The number of results currently wanted, and the reference index to continue scanning from
+    int m_resultLimit;
+    int m_scanPosition;
+    // The filtered list holds only the first of the matches
+    bool m_limited;
+    bool m_moreResults;
+    bool m_asynchronous;
+    bool m_parallel;
+    bool m_filterPending;
+    int m_filterDelay;
+    QTimer m_filterTimer;
+    QString m_pendingFilterPattern;
+    int m_pendingRequiredProperty;
+    bool m_filterChangePending;
+    // The contacts near the visible rows still to be completed, nearest first
+    QList<ContactIdType> m_prefetchIds;
+    QTimer m_prefetchTimer;
+    // The rows last reported visible by prefetch()
+    int m_visibleFirst;
+    int m_visibleLast;
+    // The rows and contacts still to be notified of a new display label order, in order
+    QList<QPair<int, ContactIdType> > m_relabelRows;
+    QVector<int> m_relabelRoles;
+    QTimer m_relabelTimer;
 };
 
 #endif
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "seasidequery.h"
+#include "seasidesearchindex.h"
+
+#include <qtcontacts-extensions.h>
+#include <QContactStatusFlags>
+
+#include <QContactEmailAddress>
+#include <QContactFavorite>
+#include <QContactName>
+#include <QContactNickname>
+#include <QContactOnlineAccount>
+#include <QContactOrganization>
+#include <QContactPhoneNumber>
+
+#include <QDebug>
+#include <QPair>
+
+USE_CONTACTS_NAMESPACE
+
+namespace {
+
+const int maximumCost = 3;
+
+// Splits the query at white space outside of quotes, removing the quotes. Operators are
+// only recognized where they were not quoted.
+QList<QPair<QString, bool> > splitQuery(const QString &query)
+{
+    QList<QPair<QString, bool> > terms;
+
+    QString term;
+    bool quoted = false;
+    bool inQuotes = false;
+    foreach (const QChar &c, query) {
+        if (c == QLatin1Char('"')) {
+            inQuotes = !inQuotes;
+            quoted = true;
+        } else if (c.isSpace() && !inQuotes) {
+            if (!term.isEmpty())
+                terms.append(qMakePair(term, quoted));
+            term.clear();
+            quoted = false;
+        } else {
+            term.append(c);
+        }
+    }
+    if (!term.isEmpty())
+        terms.append(qMakePair(term, quoted));
+
+    return terms;
+}
+
+bool containsFolded(const QString &value, const QString &folded)
+{
+    return !value.isEmpty() && SeasideSearchIndex::foldString(value).contains(folded);
+}
+
+}
+
+SeasideQuery::SeasideQuery()
+{
+}
+
+SeasideQuery::SeasideQuery(const QString &query)
+    : m_query(query)
+{
+    QList<Term> terms;
+
+    QList<QPair<QString, bool> > parts(splitQuery(query));
+    for (int i = 0; i <= parts.count(); ++i) {
+        const bool last = i == parts.count();
+        if (!last && !parts.at(i).second && parts.at(i).first == QLatin1String("AND"))
+            continue;
+
+        if (last || (!parts.at(i).second && parts.at(i).first == QLatin1String("OR"))) {
+            if (terms.isEmpty())
+                continue;
+
+            // Order the terms of the alternative so that the cheapest are checked first
+            QList<Term> alternative;
+            for (int c = 0; c <= maximumCost; ++c) {
+                foreach (const Term &term, terms) {
+                    if (cost(term) == c)
+                        alternative.append(term);
+                }
+            }
+            m_alternatives.append(alternative);
+            terms.clear();
+            continue;
+        }
+
+        Term term;
+        if (parseTerm(parts.at(i).first, &term))
+            terms.append(term);
+    }
+}
+
+int SeasideQuery::cost(const Term &term)
+{
+    switch (term.field) {
+    case Property:
+        // The status flags are held by the cache item
+        return 0;
+    case Favorite:
+        return 1;
+    case Words:
+        // The tokens are held by the search index
+        return 2;
+    default:
+        // The details must be visited and folded
+        return maximumCost;
+    }
+}
+
+bool SeasideQuery::parseTerm(const QString &text, Term *term)
+{
+    QString value(text);
+
+    term->negated = value.startsWith(QLatin1Char('-'));
+    if (term->negated)
+        value.remove(0, 1);
+
+    term->field = Words;
+    term->flag = 0;
+
+    const int separator = value.indexOf(QLatin1Char(':'));
+    if (separator > 0) {
+        const QString name(value.left(separator).toLower());
+        const QString fieldValue(value.mid(separator + 1));
+        const QString folded(SeasideSearchIndex::foldString(fieldValue));
+        bool valid = true;
+
+        if (name == QLatin1String("name")) {
+            term->field = Name;
+        } else if (name == QLatin1String("nick") || name == QLatin1String("nickname")) {
+            term->field = Nickname;
+        } else if (name == QLatin1String("org") || name == QLatin1String("organization") || name == QLatin1String("company")) {
+            term->field = Organization;
+        } else if (name == QLatin1String("email")) {
+            term->field = EmailAddress;
+        } else if (name == QLatin1String("phone") || name == QLatin1String("tel")) {
+            term->field = PhoneNumber;
+        } else if (name == QLatin1String("account")) {
+            term->field = AccountUri;
+        } else if (name == QLatin1String("favorite")) {
+            term->field = Favorite;
+            if (folded == QLatin1String("true") || folded == QLatin1String("yes") || folded == QLatin1String("1")) {
+                term->flag = 1;
+            } else if (folded != QLatin1String("false") && folded != QLatin1String("no") && folded != QLatin1String("0")) {
+                valid = false;
+            }
+        } else if (name == QLatin1String("has")) {
+            term->field = Property;
+            if (folded == QLatin1String("phone")) {
+                term->flag = QContactStatusFlags::HasPhoneNumber;
+            } else if (folded == QLatin1String("email")) {
+                term->flag = QContactStatusFlags::HasEmailAddress;
+            } else if (folded == QLatin1String("account")) {
+                term->flag = QContactStatusFlags::HasOnlineAccount;
+            } else {
+                valid = false;
+            }
+        } else {
+            valid = false;
+        }
+
+        if (valid) {
+            if (term->field == Favorite || term->field == Property)
+                return true;
+
+            // Phone numbers are compared by their digits, if there are any
+            const QString digits(term->field == PhoneNumber ? SeasideSearchIndex::numberDigits(fieldValue) : QString());
+            term->value = digits.isEmpty() ? folded : digits;
+            return !term->value.isEmpty();
+        }
+
+        // A term that can't be parsed as a field must still narrow the result, so it is
+        // matched as words
+        qWarning() << "Invalid query term, matching as words:" << text;
+        term->field = Words;
+        term->flag = 0;
+    }
+
+    // Anything else is matched as words, like a filter pattern
+    foreach (const QString &word, SeasideSearchIndex::splitWords(value))
+        term->words.append(SeasideSearchIndex::foldString(word));
+    return !term->words.isEmpty();
+}
+
+bool SeasideQuery::matches(SeasideCache::CacheItem *item, SeasideSearchIndex *index) const
+{
+    if (m_alternatives.isEmpty())
+        return true;
+
+    foreach (const QList<Term> &alternative, m_alternatives) {
+        bool matched = true;
+        foreach (const Term &term, alternative) {
+            if (!matchTerm(term, item, index)) {
+                matched = false;
+                break;
+            }
+        }
+        if (matched)
+            return true;
+    }
+    return false;
+}
+
+bool SeasideQuery::matchTerm(const Term &term, SeasideCache::CacheItem *item, SeasideSearchIndex *index)
+{
+    const QContact &contact = item->contact;
+
+    bool matched = false;
+    switch (term.field) {
+    case Property:
+        matched = (item->statusFlags & term.flag) != 0;
+        break;
+    case Favorite:
+        matched = contact.detail<QContactFavorite>().isFavorite() == (term.flag != 0);
+        break;
+    case Words:
+        matched = index->itemTokens(item).matches(term.words);
+        break;
+    case Name: {
+        QContactName name = contact.detail<QContactName>();
+#ifdef USING_QTPIM
+        const QString customLabel(name.value<QString>(QContactName__FieldCustomLabel));
+#else
+        const QString customLabel(name.customLabel());
+#endif
+        QStringList names;
+        names << name.firstName() << name.middleName() << name.lastName();
+        names.removeAll(QString());
+        matched = containsFolded(names.join(QString(QLatin1Char(' '))), term.value)
+                || containsFolded(customLabel, term.value);
+        break;
+    }
+    case Nickname:
+        foreach (const QContactNickname &detail, contact.details<QContactNickname>()) {
+            if ((matched = containsFolded(detail.nickname(), term.value)))
+                break;
+        }
+        break;
+    case Organization:
+        foreach (const QContactOrganization &detail, contact.details<QContactOrganization>()) {
+            if ((matched = containsFolded(detail.name(), term.value)))
+                break;
+        }
+        break;
+    case EmailAddress:
+        foreach (const QContactEmailAddress &detail, contact.details<QContactEmailAddress>()) {
+            if ((matched = containsFolded(detail.emailAddress(), term.value)))
+                break;
+        }
+        break;
+    case PhoneNumber:
+        foreach (const QContactPhoneNumber &detail, contact.details<QContactPhoneNumber>()) {
+            if ((matched = SeasideSearchIndex::numberDigits(detail.number()).contains(term.value)
+                        || containsFolded(detail.number(), term.value))) {
+                break;
+            }
+        }
+        break;
+    case AccountUri:
+        foreach (const QContactOnlineAccount &detail, contact.details<QContactOnlineAccount>()) {
+            if ((matched = containsFolded(detail.accountUri(), term.value)))
+                break;
+        }
+        break;
+    }
+
+    return matched != term.negated;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef SEASIDEQUERY_H
+#define SEASIDEQUERY_H
+
+#include <seasidecache.h>
+
+#include <QList>
+#include <QStringList>
+
+class SeasideSearchIndex;
+
+// A query of terms that are each matched against a field of a contact, or against its search
+// tokens. Terms are separated by white space and are all required, unless separated by OR
+// into alternatives; AND may be written explicitly, and binds more tightly than OR. A term
+// of the form field:value matches the field, and a term prefixed with '-' excludes the
+// contacts it matches. Values containing white space can be quoted. A term naming an unknown
+// field, or giving a value the field does not take, is matched as words instead.
+//
+// Each alternative is compiled into its terms in order of cost, so the checks that need
+// nothing beyond the cache item reject contacts before their details or tokens are visited.
+class SeasideQuery
+{
+public:
+    SeasideQuery();
+    explicit SeasideQuery(const QString &query);
+
+    bool isEmpty() const { return m_alternatives.isEmpty(); }
+    QString query() const { return m_query; }
+
+    // Returns true if the item satisfies every term of any of the alternatives
+    bool matches(SeasideCache::CacheItem *item, SeasideSearchIndex *index) const;
+
+private:
+    enum Field {
+        Words,
+        Name,
+        Nickname,
+        Organization,
+        EmailAddress,
+        PhoneNumber,
+        AccountUri,
+        Favorite,
+        Property
+    };
+
+    struct Term
+    {
+        Field field;
+        bool negated;
+        // The folded value, or the folded words of a Words term
+        QString value;
+        QStringList words;
+        // The status flag required by a Property term, or the value of a Favorite term
+        quint64 flag;
+    };
+
+    static int cost(const Term &term);
+    static bool parseTerm(const QString &text, Term *term);
+    static bool matchTerm(const Term &term, SeasideCache::CacheItem *item, SeasideSearchIndex *index);
+
+    QString m_query;
+    QList<QList<Term> > m_alternatives;
+};
+
+#endif
@@ -0,0 +1,1249 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "seasidesearchindex.h"
+
+#include <QContactEmailAddress>
+#include <QContactGlobalPresence>
+#include <QContactName>
+#include <QContactNickname>
+#include <QContactOnlineAccount>
+#include <QContactOrganization>
+#include <QContactPhoneNumber>
+#include <QContactPresence>
+#include <QTextBoundaryFinder>
+#include <QVarLengthArray>
+#include <QtConcurrentMap>
+
+#include <algorithm>
+#include <iterator>
+
+#include <string.h>
+
+namespace {
+
+// The smallest number of contacts worth tokenizing across the thread pool
+const int minimumParallelTokens = 64;
+
+// The length of the n-grams used to find candidates for a fuzzy match
+const int gramLength = 3;
+
+// Returns the fewest grams a token must share with a word of this many grams to be within the
+// distance of it; each edit can change at most (gramLength + 1) grams. Below one, a token within
+// the distance may share no gram at all.
+int gramThreshold(int gramCount, int maximumDistance)
+{
+    return gramCount - (gramLength + 1) * maximumDistance;
+}
+
+// Returns the first two letters of the word, swapped
+QString swappedPrefix(const QString &word)
+{
+    return QString(word.at(1)) + word.at(0);
+}
+
+// The keypad digit of each letter from 'a' to 'z'
+const char keypadLetters[] = "22233344455566677778889999";
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+// Qt 4's word boundary rules also return runs of punctuation such as "-" or "@" as words,
+// so the fast path below only reproduces the Qt 5 rules
+enum CharacterClass {
+    WordCharacter,
+    // Punctuation that joins the characters either side of it into one word, in some cases
+    JoiningCharacter,
+    SeparatingCharacter,
+    UnknownCharacter
+};
+
+// Classifies ASCII and Latin-1 characters for word splitting. Anything whose word break
+// property might vary between the Unicode versions used by Qt is unknown.
+inline CharacterClass characterClass(ushort c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+        return WordCharacter;
+
+    if (c < 0x80) {
+        switch (c) {
+        case '.': case ',': case ':': case ';': case '\'':
+            return JoiningCharacter;
+        case '_':
+            return UnknownCharacter;
+        default:
+            return SeparatingCharacter;
+        }
+    }
+
+    // The Latin-1 letters, excluding the multiplication and division signs
+    if (c >= 0xc0 && c <= 0xff && c != 0xd7 && c != 0xf7)
+        return WordCharacter;
+
+    return UnknownCharacter;
+}
+
+// Splits a string of ASCII and Latin-1 letters into the same words as QTextBoundaryFinder would,
+// without its per-character property lookups. Returns false if the string needs the full rules.
+bool splitLatin1Words(const QString &string, QStringList *words)
+{
+    const QChar *data = string.unicode();
+    const int length = string.length();
+
+    int start = -1;
+    for (int i = 0; i < length; ++i) {
+        const CharacterClass type = characterClass(data[i].unicode());
+        if (type == WordCharacter) {
+            if (start == -1)
+                start = i;
+            continue;
+        }
+        if (type == UnknownCharacter)
+            return false;
+
+        // Whether punctuation between word characters joins them depends on the characters,
+        // and for some of them on the Unicode version.
+        if (type == JoiningCharacter && start != -1 && i + 1 < length
+                && characterClass(data[i + 1].unicode()) == WordCharacter) {
+            return false;
+        }
+
+        if (start != -1) {
+            words->append(string.mid(start, i - start));
+            start = -1;
+        }
+    }
+
+    if (start != -1)
+        words->append(string.mid(start));
+    return true;
+}
+#endif
+
+}
+
+struct SeasideSearchIndex::Entry : public SeasideCache::ItemListener
+{
+    Entry(SeasideSearchIndex *searchIndex, SeasideCache::CacheItem *cacheItem)
+        : index(searchIndex), item(cacheItem), nameTokensValid(false), stale(false), statusFlags(0) {}
+
+    void itemUpdated(SeasideCache::CacheItem *) { index->itemUpdated(this); }
+    void itemAboutToBeRemoved(SeasideCache::CacheItem *) { index->itemAboutToBeRemoved(this); }
+
+    SeasideSearchIndex *index;
+    SeasideCache::CacheItem *item;
+    // The folded tokens this item is currently indexed under
+    Tokens tokens;
+    Tokens keypadTokens;
+    // The digits of the phone numbers
+    QStringList numbers;
+    // The tokens of the names, built when first needed
+    Tokens nameTokens;
+    bool nameTokensValid;
+    bool stale;
+    // The status flags when the item was last indexed
+    quint64 statusFlags;
+};
+
+SeasideSearchIndex *SeasideSearchIndex::instancePtr = 0;
+
+static void insertFolded(QSet<QString> &set, const QStringList &words)
+{
+    foreach (const QString &word, words)
+        set.insert(SeasideSearchIndex::foldString(word));
+}
+
+SeasideSearchIndex::SeasideSearchIndex()
+    : m_gramsBuilt(false)
+    , m_keypadBuilt(false)
+    , m_numbersBuilt(false)
+    , m_generation(0)
+    , m_refCount(0)
+{
+}
+
+SeasideSearchIndex::~SeasideSearchIndex()
+{
+    foreach (Entry *entry, m_entries) {
+        entry->item->removeListener(entry);
+        delete entry;
+    }
+}
+
+SeasideSearchIndex *SeasideSearchIndex::acquire()
+{
+    if (!instancePtr)
+        instancePtr = new SeasideSearchIndex;
+
+    ++instancePtr->m_refCount;
+    return instancePtr;
+}
+
+void SeasideSearchIndex::release()
+{
+    if (--m_refCount == 0) {
+        Q_ASSERT(instancePtr == this);
+        instancePtr = 0;
+        delete this;
+    }
+}
+
+bool SeasideSearchIndex::ResultKey::operator==(const ResultKey &other) const
+{
+    return filterType == other.filterType
+            && requiredProperty == other.requiredProperty
+            && searchMode == other.searchMode
+            && parts == other.parts
+            && number == other.number;
+}
+
+uint qHash(const SeasideSearchIndex::ResultKey &key)
+{
+    uint hash = qHash(key.number) ^ uint(key.filterType << 16) ^ uint(key.requiredProperty << 8) ^ uint(key.searchMode);
+    foreach (const QString &part, key.parts)
+        hash = (hash << 5) - hash + qHash(part);
+    return hash;
+}
+
+void SeasideSearchIndex::acquireResult(const ResultKey &key)
+{
+    ++m_results[key].refCount;
+}
+
+void SeasideSearchIndex::releaseResult(const ResultKey &key)
+{
+    QHash<ResultKey, Result>::iterator it = m_results.find(key);
+    if (it != m_results.end() && --it->refCount == 0)
+        m_results.erase(it);
+}
+
+int SeasideSearchIndex::generation()
+{
+    refresh();
+
+    return m_generation;
+}
+
+bool SeasideSearchIndex::cachedResult(const ResultKey &key, const QVector<ContactIdType> &reference, QBitArray *matches)
+{
+    // Updated items may or may not invalidate the result
+    refresh();
+
+    QHash<ResultKey, Result>::const_iterator it = m_results.constFind(key);
+    if (it == m_results.constEnd() || it->generation != m_generation)
+        return false;
+
+    // Comparing the lists is immediate while the stored copy still shares the reference list's data
+    if (it->reference.count() != reference.count() || it->reference != reference)
+        return false;
+
+    *matches = it->matches;
+    return true;
+}
+
+void SeasideSearchIndex::storeResult(const ResultKey &key, const QVector<ContactIdType> &reference, const QBitArray &matches)
+{
+    QHash<ResultKey, Result>::iterator it = m_results.find(key);
+    if (it == m_results.end())
+        return;
+
+    it->reference = reference;
+    it->matches = matches;
+    it->generation = m_generation;
+}
+
+SeasideSearchIndex::Tokens::Tokens(const QStringList &tokens)
+{
+    int length = 0;
+    foreach (const QString &token, tokens)
+        length += token.length();
+
+    m_data.reserve(length);
+    m_offsets.reserve(tokens.count() + 1);
+    foreach (const QString &token, tokens) {
+        m_offsets.append(m_data.length());
+        m_data.append(token);
+    }
+    m_offsets.append(m_data.length());
+}
+
+QString SeasideSearchIndex::Tokens::at(int index) const
+{
+    return m_data.mid(m_offsets.at(index), m_offsets.at(index + 1) - m_offsets.at(index));
+}
+
+bool SeasideSearchIndex::Tokens::matches(const QStringList &prefixes) const
+{
+    // we require all prefixes to match.
+    foreach (const QString &prefix, prefixes) {
+        if (!containsPrefix(prefix))
+            return false;
+    }
+    return true;
+}
+
+bool SeasideSearchIndex::Tokens::containsPrefix(const QString &prefix) const
+{
+    // Both the tokens and the prefix are folded already, so they can be compared as binary
+    const QChar *data = m_data.unicode();
+    const int length = prefix.length();
+    for (int i = 0; i + 1 < m_offsets.count(); ++i) {
+        const int begin = m_offsets.at(i);
+        if (m_offsets.at(i + 1) - begin >= length
+                && memcmp(data + begin, prefix.unicode(), length * sizeof(QChar)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SeasideSearchIndex::Tokens::contains(const QString &token) const
+{
+    const QChar *data = m_data.unicode();
+    const int length = token.length();
+    for (int i = 0; i + 1 < m_offsets.count(); ++i) {
+        const int begin = m_offsets.at(i);
+        if (m_offsets.at(i + 1) - begin == length
+                && memcmp(data + begin, token.unicode(), length * sizeof(QChar)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SeasideSearchIndex::Tokens::equals(const QStringList &tokens) const
+{
+    // The tokens are distinct, so having the same number and each of them is enough
+    if (tokens.count() != count())
+        return false;
+
+    foreach (const QString &token, tokens) {
+        if (!contains(token))
+            return false;
+    }
+    return true;
+}
+
+bool SeasideSearchIndex::Tokens::fuzzyMatches(const QStringList &prefixes) const
+{
+    foreach (const QString &prefix, prefixes) {
+        if (!containsFuzzyPrefix(prefix))
+            return false;
+    }
+    return true;
+}
+
+bool SeasideSearchIndex::Tokens::containsFuzzyPrefix(const QString &prefix) const
+{
+    if (containsPrefix(prefix))
+        return true;
+
+    const int distance = maximumDistance(prefix.length());
+    if (distance == 0)
+        return false;
+
+    // Consider the same candidates as the index would
+    const QStringList grams(tokenGrams(prefix));
+    for (int i = 0; i + 1 < m_offsets.count(); ++i) {
+        const int begin = m_offsets.at(i);
+        const QString token(QString::fromRawData(m_data.unicode() + begin, m_offsets.at(i + 1) - begin));
+        if (isFuzzyCandidate(prefix, grams, distance, token) && prefixDistance(prefix, token, distance) <= distance)
+            return true;
+    }
+    return false;
+}
+
+SeasideSearchIndex::Entry *SeasideSearchIndex::createEntry(SeasideCache::CacheItem *item)
+{
+    Entry *entry = new Entry(this, item);
+    item->appendListener(entry, this);
+    m_entries.insert(item->iid, entry);
+
+    // Matches found before don't include the new item
+    ++m_generation;
+    return entry;
+}
+
+void SeasideSearchIndex::insertItems(const QVector<ContactIdType> &ids, int begin, int end, bool parallel)
+{
+    QList<Entry *> entries;
+    QList<QContact> contacts;
+
+    for (int i = begin; i <= end; ++i) {
+        SeasideCache::CacheItem *item = SeasideCache::existingItem(ids.at(i));
+        if (!item || m_entries.contains(item->iid))
+            continue;
+
+        entries.append(createEntry(item));
+        contacts.append(item->contact);
+    }
+
+    // Tokenizing is the bulk of the cost of building the index for the first search
+    const QList<QStringList> tokens(contactTokens(contacts, parallel));
+    for (int i = 0; i < entries.count(); ++i)
+        indexEntry(entries.at(i), tokens.at(i));
+}
+
+QSet<quint32> SeasideSearchIndex::match(const QStringList &parts)
+{
+    refresh();
+
+    QSet<quint32> matches;
+    for (int i = 0; i < parts.count(); ++i) {
+        const QSet<quint32> partMatches(prefixMatch(m_tokens, parts.at(i)));
+
+        // Every part must be matched
+        if (i == 0) {
+            matches = partMatches;
+        } else {
+            matches.intersect(partMatches);
+        }
+        if (matches.isEmpty())
+            break;
+    }
+
+    return matches;
+}
+
+QSet<quint32> SeasideSearchIndex::fuzzyMatch(const QStringList &parts)
+{
+    refresh();
+
+    if (!m_gramsBuilt)
+        buildGrams();
+
+    QSet<quint32> matches;
+    for (int i = 0; i < parts.count(); ++i) {
+        const QString &part(parts.at(i));
+        const int distance = maximumDistance(part.length());
+
+        // Short words are too ambiguous to correct
+        const QSet<quint32> partMatches(distance == 0 ? prefixMatch(m_tokens, part) : fuzzyPartMatch(part, distance));
+
+        // Every part must be matched
+        if (i == 0) {
+            matches = partMatches;
+        } else {
+            matches.intersect(partMatches);
+        }
+        if (matches.isEmpty())
+            break;
+    }
+
+    return matches;
+}
+
+QSet<quint32> SeasideSearchIndex::keypadMatch(const QStringList &parts)
+{
+    refresh();
+
+    if (!m_keypadBuilt)
+        buildKeypad();
+
+    QSet<quint32> matches;
+    for (int i = 0; i < parts.count(); ++i) {
+        const QSet<quint32> partMatches(prefixMatch(m_keypadTokens, parts.at(i)));
+
+        // Every part must be matched
+        if (i == 0) {
+            matches = partMatches;
+        } else {
+            matches.intersect(partMatches);
+        }
+        if (matches.isEmpty())
+            break;
+    }
+
+    return matches;
+}
+
+QSet<quint32> SeasideSearchIndex::numberMatch(const QString &digits)
+{
+    refresh();
+
+    if (!m_numbersBuilt)
+        buildNumbers();
+    mergeNumbers();
+
+    // All the suffixes starting with the digits are adjacent in the array
+    QSet<quint32> matches;
+    const int length = digits.length();
+    for (int i = numberSuffixLowerBound(digits.unicode(), length); i < m_numberSuffixes.count(); ++i) {
+        const NumberSuffix &suffix(m_numberSuffixes.at(i));
+        if (suffix.number.length() - suffix.offset < length
+                || memcmp(suffix.number.unicode() + suffix.offset, digits.unicode(), length * sizeof(QChar)) != 0) {
+            break;
+        }
+        matches.insert(suffix.iid);
+    }
+    return matches;
+}
+
+static int compareDigits(const QChar *lhs, int lhsLength, const QChar *rhs, int rhsLength)
+{
+    const int length = qMin(lhsLength, rhsLength);
+    for (int i = 0; i < length; ++i) {
+        if (lhs[i] != rhs[i])
+            return lhs[i].unicode() - rhs[i].unicode();
+    }
+    return lhsLength - rhsLength;
+}
+
+// Returns the index of the first suffix that is not less than the digits
+int SeasideSearchIndex::numberSuffixLowerBound(const QChar *digits, int length) const
+{
+    int begin = 0;
+    int end = m_numberSuffixes.count();
+    while (begin < end) {
+        const int middle = begin + (end - begin) / 2;
+        const NumberSuffix &suffix(m_numberSuffixes.at(middle));
+        if (compareDigits(suffix.number.unicode() + suffix.offset, suffix.number.length() - suffix.offset, digits, length) < 0) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return begin;
+}
+
+bool SeasideSearchIndex::numberSuffixLessThan(const NumberSuffix &lhs, const NumberSuffix &rhs)
+{
+    return compareDigits(lhs.number.unicode() + lhs.offset, lhs.number.length() - lhs.offset,
+                         rhs.number.unicode() + rhs.offset, rhs.number.length() - rhs.offset) < 0;
+}
+
+void SeasideSearchIndex::buildNumbers()
+{
+    // The suffixes are sorted together by the first number match
+    foreach (Entry *entry, m_entries)
+        indexNumbers(entry);
+    m_numbersBuilt = true;
+}
+
+// Applies the changes to the numbers since the last number match: the suffixes of the changed
+// items are removed in one pass, and their new suffixes sorted and merged in another.
+void SeasideSearchIndex::mergeNumbers()
+{
+    if (!m_removedNumbers.isEmpty()) {
+        int to = 0;
+        for (int from = 0; from < m_numberSuffixes.count(); ++from) {
+            if (m_removedNumbers.contains(m_numberSuffixes.at(from).iid))
+                continue;
+            if (to != from)
+                m_numberSuffixes[to] = m_numberSuffixes.at(from);
+            ++to;
+        }
+        m_numberSuffixes.resize(to);
+        m_removedNumbers.clear();
+    }
+
+    if (!m_addedSuffixes.isEmpty()) {
+        std::sort(m_addedSuffixes.begin(), m_addedSuffixes.end(), numberSuffixLessThan);
+        if (m_numberSuffixes.isEmpty()) {
+            m_numberSuffixes = m_addedSuffixes;
+        } else {
+            QVector<NumberSuffix> merged;
+            merged.reserve(m_numberSuffixes.count() + m_addedSuffixes.count());
+            std::merge(m_numberSuffixes.constBegin(), m_numberSuffixes.constEnd(),
+                       m_addedSuffixes.constBegin(), m_addedSuffixes.constEnd(),
+                       std::back_inserter(merged), numberSuffixLessThan);
+            m_numberSuffixes = merged;
+        }
+        m_addedSuffixes.clear();
+    }
+}
+
+// Re-indexes the numbers of the item if they have changed, which most updates leave alone.
+// Returns true if they were re-indexed.
+bool SeasideSearchIndex::indexNumbers(Entry *entry)
+{
+    const QStringList numbers(contactNumbers(entry->item->contact));
+    if (numbers == entry->numbers)
+        return false;
+
+    unindexNumbers(entry);
+    entry->numbers = numbers;
+
+    foreach (const QString &number, entry->numbers) {
+        for (int offset = 0; offset < number.length(); ++offset) {
+            NumberSuffix suffix;
+            suffix.number = number;
+            suffix.offset = offset;
+            suffix.iid = entry->item->iid;
+            m_addedSuffixes.append(suffix);
+        }
+    }
+    return true;
+}
+
+void SeasideSearchIndex::unindexNumbers(Entry *entry)
+{
+    if (entry->numbers.isEmpty())
+        return;
+
+    const quint32 iid = entry->item->iid;
+
+    // Suffixes not merged yet are simply dropped; the merged ones are removed by mergeNumbers()
+    int to = 0;
+    for (int from = 0; from < m_addedSuffixes.count(); ++from) {
+        if (m_addedSuffixes.at(from).iid == iid)
+            continue;
+        if (to != from)
+            m_addedSuffixes[to] = m_addedSuffixes.at(from);
+        ++to;
+    }
+    m_addedSuffixes.resize(to);
+
+    m_removedNumbers.insert(iid);
+    entry->numbers.clear();
+}
+
+QSet<quint32> SeasideSearchIndex::prefixMatch(const QMap<QString, QVector<quint32> > &tokens, const QString &part)
+{
+    // All the tokens with this prefix are adjacent in the map
+    QSet<quint32> matches;
+    QMap<QString, QVector<quint32> >::const_iterator it = tokens.lowerBound(part), end = tokens.constEnd();
+    for ( ; it != end && it.key().startsWith(part); ++it) {
+        foreach (quint32 iid, it.value())
+            matches.insert(iid);
+    }
+    return matches;
+}
+
+QSet<quint32> SeasideSearchIndex::fuzzyPartMatch(const QString &part, int maximumDistance)
+{
+    // Count the grams each token shares with the part
+    const QStringList grams(tokenGrams(part));
+    const int threshold = gramThreshold(grams.count(), maximumDistance);
+
+    QHash<QString, int> shared;
+    foreach (const QString &gram, grams) {
+        QHash<QString, QSet<QString> >::const_iterator it = m_grams.constFind(gram);
+        if (it == m_grams.constEnd())
+            continue;
+        foreach (const QString &token, it.value())
+            ++shared[token];
+    }
+
+    QSet<QString> candidates;
+    for (QHash<QString, int>::const_iterator it = shared.constBegin(), end = shared.constEnd(); it != end; ++it) {
+        if (it.value() >= qMax(1, threshold))
+            candidates.insert(it.key());
+    }
+    if (threshold <= 0) {
+        // A close token may share no gram with a short part, so add those starting as it does
+        insertPrefixTokens(&candidates, part.left(1));
+        insertPrefixTokens(&candidates, swappedPrefix(part));
+    }
+
+    // Confirm the candidates by their distance from the part
+    QSet<quint32> matches;
+    foreach (const QString &token, candidates) {
+        if (prefixDistance(part, token, maximumDistance) > maximumDistance)
+            continue;
+        foreach (quint32 iid, m_tokens.value(token))
+            matches.insert(iid);
+    }
+    return matches;
+}
+
+void SeasideSearchIndex::insertPrefixTokens(QSet<QString> *tokens, const QString &prefix) const
+{
+    QMap<QString, QVector<quint32> >::const_iterator it = m_tokens.lowerBound(prefix), end = m_tokens.constEnd();
+    for ( ; it != end && it.key().startsWith(prefix); ++it)
+        tokens->insert(it.key());
+}
+
+// Returns true if the token might be within the distance of the word, given the word's grams.
+// Either it shares enough of the grams, or the word has too few grams to tell and the token
+// starts with the word's first letter or its first two letters swapped. The index finds its
+// candidates by the same rule, so a contact matches whether it is found there or checked alone.
+bool SeasideSearchIndex::isFuzzyCandidate(const QString &word, const QStringList &wordGrams, int maximumDistance, const QString &token)
+{
+    const int threshold = gramThreshold(wordGrams.count(), maximumDistance);
+    if (threshold <= 0 && (token.startsWith(word.at(0)) || token.startsWith(swappedPrefix(word))))
+        return true;
+
+    int shared = 0;
+    foreach (const QString &gram, tokenGrams(token)) {
+        if (wordGrams.contains(gram))
+            ++shared;
+    }
+    return shared >= qMax(1, threshold);
+}
+
+int SeasideSearchIndex::maximumDistance(int length)
+{
+    if (length <= gramLength)
+        return 0;
+    return length < 8 ? 1 : 2;
+}
+
+int SeasideSearchIndex::prefixDistance(const QString &word, const QString &token, int maximumDistance)
+{
+    const int wordLength = word.length();
+    // Only the prefixes within maximumDistance of the word's length can be close enough
+    const int tokenLength = qMin(token.length(), wordLength + maximumDistance);
+    if (tokenLength < wordLength - maximumDistance)
+        return maximumDistance + 1;
+
+    // Three rows of the optimal string alignment matrix: rows i-2, i-1 and i
+    const int width = tokenLength + 1;
+    QVarLengthArray<int, 3 * 32> rows(3 * width);
+    int *previous = rows.data();
+    int *current = previous + width;
+    int *next = current + width;
+
+    for (int j = 0; j < width; ++j)
+        current[j] = j;
+
+    for (int i = 1; i <= wordLength; ++i) {
+        next[0] = i;
+        int rowMinimum = i;
+        for (int j = 1; j < width; ++j) {
+            const int cost = word.at(i - 1) == token.at(j - 1) ? 0 : 1;
+            int distance = qMin(qMin(current[j] + 1, next[j - 1] + 1), current[j - 1] + cost);
+            if (i > 1 && j > 1 && word.at(i - 1) == token.at(j - 2) && word.at(i - 2) == token.at(j - 1))
+                distance = qMin(distance, previous[j - 2] + 1);
+            next[j] = distance;
+            rowMinimum = qMin(rowMinimum, distance);
+        }
+
+        // The distance can only grow from here
+        if (rowMinimum > maximumDistance)
+            return maximumDistance + 1;
+
+        int *recycled = previous;
+        previous = current;
+        current = next;
+        next = recycled;
+    }
+
+    int result = maximumDistance + 1;
+    for (int j = qMax(0, wordLength - maximumDistance); j < width; ++j)
+        result = qMin(result, current[j]);
+    return result;
+}
+
+QStringList SeasideSearchIndex::tokenGrams(const QString &token)
+{
+    // Mark the start of the token, so that its leading characters form a gram of their own
+    const QString padded(QString(QChar(0x1)) + token);
+    if (padded.length() <= gramLength)
+        return QStringList() << padded;
+
+    QStringList grams;
+    for (int i = 0; i + gramLength <= padded.length(); ++i) {
+        const QString gram(padded.mid(i, gramLength));
+        if (!grams.contains(gram))
+            grams.append(gram);
+    }
+    return grams;
+}
+
+void SeasideSearchIndex::buildGrams()
+{
+    for (QMap<QString, QVector<quint32> >::const_iterator it = m_tokens.constBegin(), end = m_tokens.constEnd(); it != end; ++it)
+        insertGrams(it.key());
+    m_gramsBuilt = true;
+}
+
+void SeasideSearchIndex::insertGrams(const QString &token)
+{
+    foreach (const QString &gram, tokenGrams(token))
+        m_grams[gram].insert(token);
+}
+
+void SeasideSearchIndex::removeGrams(const QString &token)
+{
+    foreach (const QString &gram, tokenGrams(token)) {
+        QHash<QString, QSet<QString> >::iterator it = m_grams.find(gram);
+        if (it == m_grams.end())
+            continue;
+
+        it.value().remove(token);
+        if (it.value().isEmpty())
+            m_grams.erase(it);
+    }
+}
+
+void SeasideSearchIndex::buildKeypad()
+{
+    foreach (Entry *entry, m_entries)
+        indexKeypad(entry, contactKeypadTokens(entry->item->contact));
+    m_keypadBuilt = true;
+}
+
+SeasideSearchIndex::Entry *SeasideSearchIndex::currentEntry(SeasideCache::CacheItem *item)
+{
+    Entry *entry = m_entries.value(item->iid);
+    if (!entry) {
+        entry = createEntry(item);
+        indexEntry(entry, contactTokens(item->contact));
+    } else if (entry->stale) {
+        refresh();
+    }
+    return entry;
+}
+
+SeasideSearchIndex::Tokens SeasideSearchIndex::itemTokens(SeasideCache::CacheItem *item)
+{
+    return currentEntry(item)->tokens;
+}
+
+SeasideSearchIndex::Tokens SeasideSearchIndex::itemKeypadTokens(SeasideCache::CacheItem *item)
+{
+    Entry *entry = currentEntry(item);
+    if (!m_keypadBuilt)
+        buildKeypad();
+    return entry->keypadTokens;
+}
+
+SeasideSearchIndex::Tokens SeasideSearchIndex::itemNameTokens(SeasideCache::CacheItem *item)
+{
+    Entry *entry = currentEntry(item);
+    if (!entry->nameTokensValid) {
+        entry->nameTokens = Tokens(contactNameTokens(item->contact));
+        entry->nameTokensValid = true;
+    }
+    return entry->nameTokens;
+}
+
+bool SeasideSearchIndex::itemHasNumber(SeasideCache::CacheItem *item, const QString &digits)
+{
+    Entry *entry = currentEntry(item);
+    if (!m_numbersBuilt)
+        buildNumbers();
+
+    foreach (const QString &number, entry->numbers) {
+        if (number.contains(digits))
+            return true;
+    }
+    return false;
+}
+
+void SeasideSearchIndex::indexEntry(Entry *entry, const QStringList &tokens)
+{
+    indexTokens(entry, tokens);
+    entry->statusFlags = entry->item->statusFlags;
+
+    if (m_keypadBuilt)
+        indexKeypad(entry, contactKeypadTokens(entry->item->contact));
+    if (m_numbersBuilt)
+        indexNumbers(entry);
+}
+
+void SeasideSearchIndex::indexTokens(Entry *entry, const QStringList &tokens)
+{
+    entry->tokens = Tokens(tokens);
+    foreach (const QString &token, tokens) {
+        QVector<quint32> &iids(m_tokens[token]);
+        if (iids.isEmpty() && m_gramsBuilt)
+            insertGrams(token);
+        iids.append(entry->item->iid);
+    }
+}
+
+void SeasideSearchIndex::indexKeypad(Entry *entry, const QStringList &tokens)
+{
+    entry->keypadTokens = Tokens(tokens);
+    foreach (const QString &token, tokens)
+        m_keypadTokens[token].append(entry->item->iid);
+}
+
+void SeasideSearchIndex::unindexEntry(Entry *entry)
+{
+    unindexTokens(entry);
+    unindexKeypad(entry);
+
+    entry->nameTokens = Tokens();
+    entry->nameTokensValid = false;
+}
+
+void SeasideSearchIndex::unindexTokens(Entry *entry)
+{
+    const quint32 iid = entry->item->iid;
+    for (int i = 0; i < entry->tokens.count(); ++i) {
+        const QString token(entry->tokens.at(i));
+        if (removeToken(m_tokens, token, iid) && m_gramsBuilt)
+            removeGrams(token);
+    }
+    entry->tokens = Tokens();
+}
+
+void SeasideSearchIndex::unindexKeypad(Entry *entry)
+{
+    const quint32 iid = entry->item->iid;
+    for (int i = 0; i < entry->keypadTokens.count(); ++i)
+        removeToken(m_keypadTokens, entry->keypadTokens.at(i), iid);
+    entry->keypadTokens = Tokens();
+}
+
+// Re-indexes an updated item, touching only what has changed. Returns true if the item is now
+// indexed differently, or its status flags differ, so that matches found before may be wrong.
+bool SeasideSearchIndex::reindexEntry(Entry *entry)
+{
+    const QContact &contact(entry->item->contact);
+    bool changed = false;
+
+    // Which names a token came from may change without the tokens changing
+    entry->nameTokens = Tokens();
+    entry->nameTokensValid = false;
+
+    const QStringList tokens(contactTokens(contact));
+    if (!entry->tokens.equals(tokens)) {
+        unindexTokens(entry);
+        indexTokens(entry, tokens);
+        changed = true;
+    }
+
+    if (m_keypadBuilt) {
+        const QStringList keypadTokens(contactKeypadTokens(contact));
+        if (!entry->keypadTokens.equals(keypadTokens)) {
+            unindexKeypad(entry);
+            indexKeypad(entry, keypadTokens);
+            changed = true;
+        }
+    }
+
+    if (m_numbersBuilt && indexNumbers(entry))
+        changed = true;
+
+    if (entry->statusFlags != entry->item->statusFlags) {
+        entry->statusFlags = entry->item->statusFlags;
+        changed = true;
+    }
+
+    return changed;
+}
+
+// Removes the item from the token's list, and returns true if the token is no longer present
+bool SeasideSearchIndex::removeToken(QMap<QString, QVector<quint32> > &tokens, const QString &token, quint32 iid)
+{
+    QMap<QString, QVector<quint32> >::iterator it = tokens.find(token);
+    if (it == tokens.end())
+        return false;
+
+    QVector<quint32> &iids(it.value());
+    const int index = iids.indexOf(iid);
+    if (index != -1)
+        iids.remove(index);
+    if (!iids.isEmpty())
+        return false;
+
+    tokens.erase(it);
+    return true;
+}
+
+void SeasideSearchIndex::itemUpdated(Entry *entry)
+{
+    // Re-index lazily, so that a burst of updates costs nothing until the next search. The
+    // generation only changes if the re-indexing finds a difference.
+    if (!entry->stale) {
+        entry->stale = true;
+        m_staleEntries.append(entry);
+    }
+}
+
+void SeasideSearchIndex::itemAboutToBeRemoved(Entry *entry)
+{
+    ++m_generation;
+
+    unindexEntry(entry);
+    unindexNumbers(entry);
+    if (entry->stale)
+        m_staleEntries.removeOne(entry);
+
+    m_entries.remove(entry->item->iid);
+    entry->item->removeListener(entry);
+    delete entry;
+}
+
+void SeasideSearchIndex::refresh()
+{
+    bool changed = false;
+    foreach (Entry *entry, m_staleEntries) {
+        if (reindexEntry(entry))
+            changed = true;
+        entry->stale = false;
+    }
+    m_staleEntries.clear();
+
+    // Updates that leave the indexed details alone, such as presence changes, keep the
+    // matches found before valid
+    if (changed)
+        ++m_generation;
+}
+
+// Splits a string into words, as splitBoundaryWords() does. Most names and numbers can be
+// split by character class alone, which is much cheaper than finding the word boundaries.
+QStringList SeasideSearchIndex::splitWords(const QString &string)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QStringList words;
+    if (splitLatin1Words(string, &words))
+        return words;
+#endif
+
+    return splitBoundaryWords(string);
+}
+
+// Splits a string at word boundaries identified by QTextBoundaryFinder and returns a list of
+// of the fragments that occur between StartWord and EndWord boundaries.
+QStringList SeasideSearchIndex::splitBoundaryWords(const QString &string)
+{
+    QStringList words;
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Word, string);
+
+    for (int start = 0; finder.position() != -1 && finder.position() < string.length();) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+        if (!(finder.boundaryReasons() & QTextBoundaryFinder::StartOfItem)) {
+#else
+        if (!(finder.boundaryReasons() & QTextBoundaryFinder::StartWord)) {
+#endif
+            finder.toNextBoundary();
+            start = finder.position();
+        }
+
+        finder.toNextBoundary();
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+        if (finder.position() > start && finder.boundaryReasons() & QTextBoundaryFinder::EndOfItem) {
+#else
+        if (finder.position() > start && finder.boundaryReasons() & QTextBoundaryFinder::EndWord) {
+#endif
+            words.append(string.mid(start, finder.position() - start));
+            start = finder.position();
+        }
+    }
+    return words;
+}
+
+// Returns a form of the string that can be compared to other folded strings without regard
+// to case or diacritics: the compatibility decomposition, without combining marks, case-folded.
+QString SeasideSearchIndex::foldString(const QString &string)
+{
+    const QChar *data = string.unicode();
+    const QChar *end = data + string.length();
+    for ( ; data != end; ++data) {
+        if (data->unicode() >= 0x80)
+            break;
+    }
+    if (data == end) {
+        // ASCII has no decomposition
+        return string.toCaseFolded();
+    }
+
+    const QString decomposed(string.normalized(QString::NormalizationForm_KD));
+
+    QString folded;
+    folded.reserve(decomposed.length());
+    foreach (const QChar &c, decomposed) {
+        switch (c.category()) {
+        case QChar::Mark_NonSpacing:
+        case QChar::Mark_SpacingCombining:
+        case QChar::Mark_Enclosing:
+            break;
+        default:
+            folded.append(c);
+            break;
+        }
+    }
+    return folded.toCaseFolded();
+}
+
+// Returns the distinct folded words of the contact details that a filter pattern is matched against.
+//
+// TODO: i18n will require different splitting for thai and possibly
+// other locales, see MBreakIterator
+QStringList SeasideSearchIndex::contactTokens(const QContact &contact)
+{
+    QSet<QString> matchTokens;
+
+    QContactName name = contact.detail<QContactName>();
+    insertFolded(matchTokens, splitWords(name.firstName()));
+    insertFolded(matchTokens, splitWords(name.middleName()));
+    insertFolded(matchTokens, splitWords(name.lastName()));
+    insertFolded(matchTokens, splitWords(name.prefix()));
+    insertFolded(matchTokens, splitWords(name.suffix()));
+
+    QContactNickname nickname = contact.detail<QContactNickname>();
+    insertFolded(matchTokens, splitWords(nickname.nickname()));
+
+    // Include the custom label - it may contain the user's customized name for the contact
+#ifdef USING_QTPIM
+    insertFolded(matchTokens, splitWords(name.value<QString>(QContactName__FieldCustomLabel)));
+#else
+    insertFolded(matchTokens, splitWords(name.customLabel()));
+#endif
+
+    foreach (const QContactPhoneNumber &detail, contact.details<QContactPhoneNumber>())
+        insertFolded(matchTokens, splitWords(detail.number()));
+    foreach (const QContactEmailAddress &detail, contact.details<QContactEmailAddress>())
+        insertFolded(matchTokens, splitWords(detail.emailAddress()));
+    foreach (const QContactOrganization &detail, contact.details<QContactOrganization>())
+        insertFolded(matchTokens, splitWords(detail.name()));
+    foreach (const QContactOnlineAccount &detail, contact.details<QContactOnlineAccount>()) {
+        insertFolded(matchTokens, splitWords(detail.accountUri()));
+        insertFolded(matchTokens, splitWords(detail.serviceProvider()));
+    }
+    foreach (const QContactGlobalPresence &detail, contact.details<QContactGlobalPresence>())
+        insertFolded(matchTokens, splitWords(detail.nickname()));
+    foreach (const QContactPresence &detail, contact.details<QContactPresence>())
+        insertFolded(matchTokens, splitWords(detail.nickname()));
+
+    return matchTokens.toList();
+}
+
+// Returns the folded tokens of the names the contact is known by, for ranking matches
+QStringList SeasideSearchIndex::contactNameTokens(const QContact &contact)
+{
+    QSet<QString> nameTokens;
+
+    QContactName name = contact.detail<QContactName>();
+    insertFolded(nameTokens, splitWords(name.firstName()));
+    insertFolded(nameTokens, splitWords(name.middleName()));
+    insertFolded(nameTokens, splitWords(name.lastName()));
+
+    QContactNickname nickname = contact.detail<QContactNickname>();
+    insertFolded(nameTokens, splitWords(nickname.nickname()));
+
+#ifdef USING_QTPIM
+    insertFolded(nameTokens, splitWords(name.value<QString>(QContactName__FieldCustomLabel)));
+#else
+    insertFolded(nameTokens, splitWords(name.customLabel()));
+#endif
+
+    return nameTokens.toList();
+}
+
+static void insertKeypad(QSet<QString> &set, const QStringList &words)
+{
+    foreach (const QString &word, words) {
+        const QString digits(SeasideSearchIndex::keypadDigits(SeasideSearchIndex::foldString(word)));
+        if (!digits.isEmpty())
+            set.insert(digits);
+    }
+}
+
+// Returns the keypad forms of the names of the contact, and the digits of its phone numbers
+QStringList SeasideSearchIndex::contactKeypadTokens(const QContact &contact)
+{
+    QSet<QString> keypadTokens;
+
+    QContactName name = contact.detail<QContactName>();
+    insertKeypad(keypadTokens, splitWords(name.firstName()));
+    insertKeypad(keypadTokens, splitWords(name.middleName()));
+    insertKeypad(keypadTokens, splitWords(name.lastName()));
+
+    QContactNickname nickname = contact.detail<QContactNickname>();
+    insertKeypad(keypadTokens, splitWords(nickname.nickname()));
+
+#ifdef USING_QTPIM
+    insertKeypad(keypadTokens, splitWords(name.value<QString>(QContactName__FieldCustomLabel)));
+#else
+    insertKeypad(keypadTokens, splitWords(name.customLabel()));
+#endif
+
+    foreach (const QContactPhoneNumber &detail, contact.details<QContactPhoneNumber>()) {
+        // Match the whole number as well as each group of digits in it
+        const QString number(detail.number());
+        const QString digits(numberDigits(number));
+        if (!digits.isEmpty())
+            keypadTokens.insert(digits);
+        foreach (const QString &word, splitWords(number)) {
+            const QString wordDigits(numberDigits(word));
+            if (!wordDigits.isEmpty())
+                keypadTokens.insert(wordDigits);
+        }
+    }
+
+    return keypadTokens.toList();
+}
+
+// Returns the distinct digit sequences of the phone numbers of the contact
+QStringList SeasideSearchIndex::contactNumbers(const QContact &contact)
+{
+    QStringList numbers;
+    foreach (const QContactPhoneNumber &detail, contact.details<QContactPhoneNumber>()) {
+        const QString digits(numberDigits(detail.number()));
+        if (!digits.isEmpty() && !numbers.contains(digits))
+            numbers.append(digits);
+    }
+    return numbers;
+}
+
+QString SeasideSearchIndex::keypadDigits(const QString &word)
+{
+    QString digits;
+    digits.reserve(word.length());
+
+    const QChar *data = word.unicode();
+    for (const QChar *end = data + word.length(); data != end; ++data) {
+        const ushort code = data->unicode();
+        if (code >= 'a' && code <= 'z') {
+            digits.append(QLatin1Char(keypadLetters[code - 'a']));
+        } else if (code >= '0' && code <= '9') {
+            digits.append(*data);
+        } else {
+            // Not a letter of the keypad
+            return QString();
+        }
+    }
+    return digits;
+}
+
+QString SeasideSearchIndex::numberDigits(const QString &number)
+{
+    QString digits;
+    digits.reserve(number.length());
+
+    const QChar *data = number.unicode();
+    for (const QChar *end = data + number.length(); data != end; ++data) {
+        if (data->unicode() >= '0' && data->unicode() <= '9')
+            digits.append(*data);
+    }
+    return digits;
+}
+
+// Returns the tokens of each of the contacts, tokenizing them across the thread pool if
+// parallel is true. The contacts are copies, so they can be read from any thread.
+QList<QStringList> SeasideSearchIndex::contactTokens(const QList<QContact> &contacts, bool parallel)
+{
+    if (parallel && contacts.count() >= minimumParallelTokens) {
+        QStringList (*tokenize)(const QContact &) = &SeasideSearchIndex::contactTokens;
+        return QtConcurrent::blockingMapped<QList<QStringList> >(contacts, tokenize);
+    }
+
+    QList<QStringList> tokens;
+    tokens.reserve(contacts.count());
+    foreach (const QContact &contact, contacts)
+        tokens.append(contactTokens(contact));
+    return tokens;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef SEASIDESEARCHINDEX_H
+#define SEASIDESEARCHINDEX_H
+
+#include <seasidecache.h>
+
+#include <QBitArray>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+#include <QContact>
+
+USE_CONTACTS_NAMESPACE
+
+// A sorted index of the search tokens of every indexed contact, shared by all models.
+// Resolving a filter word to the set of matching contacts costs a lookup in the token
+// map plus the number of matching tokens, rather than a scan of each contact's tokens.
+class SeasideSearchIndex
+{
+public:
+    typedef SeasideCache::ContactIdType ContactIdType;
+
+    // The folded tokens of an item, stored in a single buffer
+    class Tokens
+    {
+    public:
+        Tokens() {}
+        explicit Tokens(const QStringList &tokens);
+
+        bool isEmpty() const { return m_offsets.count() < 2; }
+        int count() const { return isEmpty() ? 0 : m_offsets.count() - 1; }
+        QString at(int index) const;
+
+        // Returns true if some token starts with each of the folded prefixes
+        bool matches(const QStringList &prefixes) const;
+        bool containsPrefix(const QString &prefix) const;
+        bool contains(const QString &token) const;
+        // Returns true if the tokens are those of the list, in any order
+        bool equals(const QStringList &tokens) const;
+
+        // As matches(), but allowing each prefix to be misspelled by up to maximumDistance()
+        bool fuzzyMatches(const QStringList &prefixes) const;
+        bool containsFuzzyPrefix(const QString &prefix) const;
+
+    private:
+        QString m_data;
+        // The start of each token in the buffer, and the end of the last
+        QVector<int> m_offsets;
+    };
+
+    // Identifies the filters whose matches of a reference list can be shared between models
+    struct ResultKey
+    {
+        int filterType;
+        int requiredProperty;
+        int searchMode;
+        QStringList parts;
+        QString number;
+
+        bool operator==(const ResultKey &other) const;
+    };
+
+    static SeasideSearchIndex *acquire();
+    void release();
+
+    // Changes whenever the indexed details of the items change, or items are added to the index
+    int generation();
+
+    // Registers interest in the matches of a filter, which are kept while any model is interested
+    void acquireResult(const ResultKey &key);
+    void releaseResult(const ResultKey &key);
+    // Returns true if the matches of the reference list stored for the filter are still current
+    bool cachedResult(const ResultKey &key, const QVector<ContactIdType> &reference, QBitArray *matches);
+    void storeResult(const ResultKey &key, const QVector<ContactIdType> &reference, const QBitArray &matches);
+
+    // Adds the items in ids[begin..end] to the index, if they are not already present
+    void insertItems(const QVector<ContactIdType> &ids, int begin, int end, bool parallel = false);
+
+    // Returns the iids of the items having a token starting with every one of the folded parts
+    QSet<quint32> match(const QStringList &parts);
+
+    // Returns the iids of the items having a token starting with a close spelling of every part
+    QSet<quint32> fuzzyMatch(const QStringList &parts);
+
+    // Returns the iids of the items having a keypad token starting with every one of the digit parts
+    QSet<quint32> keypadMatch(const QStringList &parts);
+
+    // Returns the iids of the items having a phone number containing the digits
+    QSet<quint32> numberMatch(const QString &digits);
+
+    // Returns the current tokens of an item, adding it to the index if necessary
+    Tokens itemTokens(SeasideCache::CacheItem *item);
+    // Returns the keypad digits of the item's names, and the digits of its phone numbers
+    Tokens itemKeypadTokens(SeasideCache::CacheItem *item);
+    // Returns the folded tokens of the item's names alone
+    Tokens itemNameTokens(SeasideCache::CacheItem *item);
+    // Returns true if one of the item's phone numbers contains the digits
+    bool itemHasNumber(SeasideCache::CacheItem *item, const QString &digits);
+
+    // The number of edits tolerated in a fuzzy match of a folded word of this length
+    static int maximumDistance(int length);
+    // Returns the smallest edit distance between the word and any prefix of the token, or
+    // maximumDistance + 1 if that is exceeded. Transpositions count as a single edit.
+    static int prefixDistance(const QString &word, const QString &token, int maximumDistance);
+
+    static QStringList splitWords(const QString &string);
+    static QStringList splitBoundaryWords(const QString &string);
+    static QString foldString(const QString &string);
+    static QStringList contactTokens(const QContact &contact);
+    static QStringList contactNameTokens(const QContact &contact);
+    static QList<QStringList> contactTokens(const QList<QContact> &contacts, bool parallel);
+    static QStringList contactKeypadTokens(const QContact &contact);
+    static QStringList contactNumbers(const QContact &contact);
+
+    // Returns the keypad digits that type the folded word, or an empty string if it can't be typed
+    static QString keypadDigits(const QString &word);
+    // Returns the digits of the number, without any punctuation
+    static QString numberDigits(const QString &number);
+
+private:
+    struct Entry;
+
+    // A suffix of one of the indexed phone numbers
+    struct NumberSuffix
+    {
+        QString number;
+        int offset;
+        quint32 iid;
+    };
+
+    // The matches of a filter, valid while the reference list and the indexed items are unchanged
+    struct Result
+    {
+        Result() : generation(-1), refCount(0) {}
+
+        QVector<ContactIdType> reference;
+        QBitArray matches;
+        int generation;
+        int refCount;
+    };
+
+    SeasideSearchIndex();
+    ~SeasideSearchIndex();
+
+    Entry *createEntry(SeasideCache::CacheItem *item);
+    Entry *currentEntry(SeasideCache::CacheItem *item);
+
+    void indexEntry(Entry *entry, const QStringList &tokens);
+    void unindexEntry(Entry *entry);
+    bool reindexEntry(Entry *entry);
+    void indexTokens(Entry *entry, const QStringList &tokens);
+    void unindexTokens(Entry *entry);
+    void indexKeypad(Entry *entry, const QStringList &tokens);
+    void unindexKeypad(Entry *entry);
+    bool indexNumbers(Entry *entry);
+    void unindexNumbers(Entry *entry);
+
+    void itemUpdated(Entry *entry);
+    void itemAboutToBeRemoved(Entry *entry);
+
+    void refresh();
+
+    static QSet<quint32> prefixMatch(const QMap<QString, QVector<quint32> > &tokens, const QString &part);
+    static bool removeToken(QMap<QString, QVector<quint32> > &tokens, const QString &token, quint32 iid);
+    QSet<quint32> fuzzyPartMatch(const QString &part, int maximumDistance);
+    void insertPrefixTokens(QSet<QString> *tokens, const QString &prefix) const;
+    static bool isFuzzyCandidate(const QString &word, const QStringList &wordGrams, int maximumDistance, const QString &token);
+
+    static QStringList tokenGrams(const QString &token);
+    void buildGrams();
+    void insertGrams(const QString &token);
+    void removeGrams(const QString &token);
+    void buildKeypad();
+    void buildNumbers();
+    void mergeNumbers();
+    int numberSuffixLowerBound(const QChar *digits, int length) const;
+    static bool numberSuffixLessThan(const NumberSuffix &lhs, const NumberSuffix &rhs);
+
+    QMap<QString, QVector<quint32> > m_tokens;
+    // The tokens containing each trigram, built on the first fuzzy match
+    QHash<QString, QSet<QString> > m_grams;
+    bool m_gramsBuilt;
+    // The keypad digits of the name tokens and phone numbers, built on the first keypad match
+    QMap<QString, QVector<quint32> > m_keypadTokens;
+    bool m_keypadBuilt;
+    // The suffixes of the digits of every phone number in order, built on the first number match
+    QVector<NumberSuffix> m_numberSuffixes;
+    bool m_numbersBuilt;
+    // The items whose suffixes are to be removed, and the suffixes to be merged in, at the next number match
+    QSet<quint32> m_removedNumbers;
+    QVector<NumberSuffix> m_addedSuffixes;
+    QHash<quint32, Entry *> m_entries;
+    QList<Entry *> m_staleEntries;
+    QHash<ResultKey, Result> m_results;
+    // Incremented whenever the indexed details change, invalidating the stored results
+    int m_generation;
+    int m_refCount;
+
+    static SeasideSearchIndex *instancePtr;
+};
+
+uint qHash(const SeasideSearchIndex::ResultKey &key);
+
+#endif
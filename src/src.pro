@@ -11,7 +11,7 @@ equals(QT_MAJOR_VERSION, 4) {
     PKGCONFIG += contactcache
 }
 equals(QT_MAJOR_VERSION, 5) {
-    QT += qml
+    QT += qml concurrent
     PKGCONFIG += contactcache-qt5
 }
 
@@ -27,8 +27,12 @@ INSTALLS += qmldir
 SOURCES += $$PWD/plugin.cpp \
            $$PWD/seasideperson.cpp \
            $$PWD/seasidefilteredmodel.cpp \
-           $$PWD/seasidenamegroupmodel.cpp
+           $$PWD/seasidenamegroupmodel.cpp \
+           $$PWD/seasidequery.cpp \
+           $$PWD/seasidesearchindex.cpp
 
 HEADERS += $$PWD/seasideperson.h \
            $$PWD/seasidefilteredmodel.h \
-           $$PWD/seasidenamegroupmodel.h
+           $$PWD/seasidenamegroupmodel.h \
+           $$PWD/seasidequery.h \
+           $$PWD/seasidesearchindex.h
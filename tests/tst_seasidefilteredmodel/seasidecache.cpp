@@ -157,6 +157,18 @@ SeasideCache::SeasideCache()
 
 void SeasideCache::reset()
 {
+    // Items are about to be destroyed; let any listeners release their data
+    for (int i = 0; i < m_cache.count(); ++i) {
+        CacheItem &cacheItem = m_cache[i];
+
+        ItemListener *listener(cacheItem.listeners);
+        while (listener) {
+            ItemListener *next = listener->next;
+            listener->itemAboutToBeRemoved(&cacheItem);
+            listener = next;
+        }
+    }
+
     for (int i = 0; i < FilterTypesCount; ++i) {
         m_contacts[i].clear();
         m_populated[i] = false;
@@ -164,6 +176,7 @@ void SeasideCache::reset()
     }
 
     m_cache.clear();
+    m_completionRequests.clear();
 #ifdef USING_QTPIM
     m_cacheIndices.clear();
 #endif
@@ -396,8 +409,12 @@ QList<QChar> SeasideCache::allNameGroups()
     return QList<QChar>();
 }
 
-void SeasideCache::ensureCompletion(CacheItem *)
+void SeasideCache::ensureCompletion(CacheItem *cacheItem)
 {
+    if (cacheItem->contactState < ContactRequested) {
+        cacheItem->contactState = ContactRequested;
+        instancePtr->m_completionRequests.append(cacheItem->iid);
+    }
 }
 
 void SeasideCache::refreshContact(CacheItem *)
@@ -571,6 +588,11 @@ void SeasideCache::setFirstName(FilterType filterType, int index, const QString
         m_models[filterType]->sourceDataChanged(index, index);
 }
 
+void SeasideCache::setContactState(int index, ContactState state)
+{
+    m_cache[index].contactState = state;
+}
+
 SeasideCache::ContactIdType SeasideCache::idAt(int index) const
 {
 #ifdef USING_QTPIM
@@ -64,12 +64,14 @@ public:
     struct CacheItem;
     struct ItemListener
     {
+        ItemListener() : next(0), key(0) {}
         virtual ~ItemListener() {}
 
         virtual void itemUpdated(CacheItem *) {};
         virtual void itemAboutToBeRemoved(CacheItem *) {};
 
         ItemListener *next;
+        void *key;
     };
 
     struct CacheItem
@@ -79,10 +81,36 @@ public:
             : contact(contact), itemData(0), iid(internalId(contact)),
               statusFlags(contact.detail<QContactStatusFlags>().flagsValue()), contactState(ContactComplete), listeners(0) {}
 
-        ItemListener *listener(void *) { return 0; }
-
-        ItemListener *appendListener(ItemListener *listener, void *) { listeners = listener; listener->next = 0; return listener; }
-        bool removeListener(ItemListener *) { listeners = 0; return true; }
+        ItemListener *listener(void *key)
+        {
+            ItemListener *listener = listeners;
+            while (listener && listener->key != key)
+                listener = listener->next;
+            return listener;
+        }
+
+        ItemListener *appendListener(ItemListener *listener, void *key)
+        {
+            ItemListener **tail = &listeners;
+            while (*tail)
+                tail = &(*tail)->next;
+
+            *tail = listener;
+            listener->next = 0;
+            listener->key = key;
+            return listener;
+        }
+
+        bool removeListener(ItemListener *listener)
+        {
+            for (ItemListener **link = &listeners; *link; link = &(*link)->next) {
+                if (*link == listener) {
+                    *link = listener->next;
+                    return true;
+                }
+            }
+            return false;
+        }
 
         QContact contact;
         ItemData *itemData;
@@ -206,6 +234,7 @@ public:
     static QString exportContacts();
 
     void setFirstName(FilterType filterType, int index, const QString &name);
+    void setContactState(int index, ContactState state);
 
     void reset();
 
@@ -216,6 +245,8 @@ public:
     bool m_populated[FilterTypesCount];
 
     QVector<CacheItem> m_cache;
+    // The iids of the items whose completion has been requested, in order
+    QList<quint32> m_completionRequests;
 #ifdef USING_QTPIM
     QHash<ContactIdType, int> m_cacheIndices;
 #endif
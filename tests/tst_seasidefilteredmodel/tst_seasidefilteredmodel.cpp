@@ -40,6 +40,7 @@
 #include "seasidefilteredmodel.h"
 #include "seasidecache.h"
 #include "seasideperson.h"
+#include "seasidesearchindex.h"
 
 Q_DECLARE_METATYPE(QModelIndex)
 
@@ -57,14 +58,37 @@ private slots:
     void filterType();
     void filterPattern();
     void filterEmail();
+    void filterHistory();
+    void wordRefinement();
+    void refinementRanges();
     void rowsInserted();
     void rowsRemoved();
     void dataChanged();
+    void changedRoles();
     void data();
+    void getRange();
+    void prefetch();
+    void displayLabelOrder();
     void filterId();
+    void searchIndex();
+    void filterDiacritics();
+    void splitWords();
+    void fuzzySearch();
+    void keypadSearch();
+    void numberSearch();
+    void relevanceOrder();
+    void maxResults();
+    void selectiveChanges();
+    void matchRanges();
+    void sharedResults();
+    void query();
+    void asynchronous();
+    void parallel();
+    void filterDelay();
     void searchByFirstNameCharacter();
     void lookupById();
     void requiredProperty();
+    void requiredPropertyRows();
     void mixedFilters();
 
 private:
@@ -76,6 +100,9 @@ private:
 tst_SeasideFilteredModel::tst_SeasideFilteredModel()
 {
     qRegisterMetaType<QModelIndex>();
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    qRegisterMetaType<QVector<int> >();
+#endif
 }
 
 
@@ -416,6 +443,168 @@ void tst_SeasideFilteredModel::filterEmail()
     QCOMPARE(removedSpy.count(), 0);
 }
 
+void tst_SeasideFilteredModel::filterHistory()
+{
+    SeasideFilteredModel model;
+    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+
+    // 0 1 2 3 4
+    model.setFilterPattern("a");
+    // 0 1 2 4
+    model.setFilterPattern("aa");
+    // 0 4
+    model.setFilterPattern("aaronso");
+    QCOMPARE(model.rowCount(), 2);
+
+    insertedSpy.clear();
+    removedSpy.clear();
+
+    // 0 1 2 4
+    model.setFilterPattern("aa");
+    QCOMPARE(model.rowCount(), 4);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.at(0).at(1).value<int>(), 1);
+    QCOMPARE(insertedSpy.at(0).at(2).value<int>(), 2);
+    QCOMPARE(removedSpy.count(), 0);
+
+    insertedSpy.clear();
+
+    // 1 3
+    model.setFilterPattern("ar");
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.index(QModelIndex(), 0, 0).data(SeasideFilteredModel::LastNameRole).toString(), QString::fromLatin1("Arthur"));
+    QCOMPARE(model.index(QModelIndex(), 1, 0).data(SeasideFilteredModel::LastNameRole).toString(), QString::fromLatin1("Johns"));
+
+    insertedSpy.clear();
+    removedSpy.clear();
+
+    // 0 1 2 3 4
+    model.setFilterPattern("a");
+    QCOMPARE(model.rowCount(), 5);
+    QCOMPARE(insertedSpy.count(), 3);
+    QCOMPARE(insertedSpy.at(0).at(1).value<int>(), 0);
+    QCOMPARE(insertedSpy.at(0).at(2).value<int>(), 0);
+    QCOMPARE(insertedSpy.at(1).at(1).value<int>(), 2);
+    QCOMPARE(insertedSpy.at(1).at(2).value<int>(), 2);
+    QCOMPARE(insertedSpy.at(2).at(1).value<int>(), 4);
+    QCOMPARE(insertedSpy.at(2).at(2).value<int>(), 4);
+    QCOMPARE(removedSpy.count(), 0);
+}
+
+void tst_SeasideFilteredModel::wordRefinement()
+{
+    SeasideFilteredModel model;
+    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+
+    // 2 3 4
+    model.setFilterPattern("a j");
+    QCOMPARE(model.rowCount(), 3);
+
+    insertedSpy.clear();
+    removedSpy.clear();
+
+    // Lengthening the first word refines the previous results: 2 4
+    model.setFilterPattern("aa j");
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(insertedSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(removedSpy.at(0).at(1).value<int>(), 1);
+    QCOMPARE(removedSpy.at(0).at(2).value<int>(), 1);
+
+    removedSpy.clear();
+
+    // As does inserting a word: 2
+    model.setFilterPattern("aa ar j");
+    QCOMPARE(model.rowCount(), 0);
+    model.setFilterPattern("aa jo");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(2));
+
+    // Replacing a word does not: 3
+    model.setFilterPattern("ar jo");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(3));
+
+    // The matches of unchanged words follow changes to the contacts: 4
+    model.setFilterPattern("ja");
+    QCOMPARE(model.rowCount(), 1);
+    cache.setFirstName(SeasideCache::FilterAll, 0, "Jake");
+    QCOMPARE(model.rowCount(), 2);
+    model.setFilterPattern("ja aaronson");
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(0));
+    QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(4));
+}
+
+void tst_SeasideFilteredModel::refinementRanges()
+{
+    {
+        SeasideFilteredModel model;
+        QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+        QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+
+        // Each run of rows that no longer match is removed at once: 0 1 2 4
+        model.setFilterPattern("Aaron");
+        QCOMPARE(model.rowCount(), 4);
+        QCOMPARE(resetSpy.count(), 0);
+        QCOMPARE(removedSpy.count(), 2);
+        QCOMPARE(removedSpy.at(0).at(1).toInt(), 3);
+        QCOMPARE(removedSpy.at(0).at(2).toInt(), 3);
+        QCOMPARE(removedSpy.at(1).at(1).toInt(), 4);
+        QCOMPARE(removedSpy.at(1).at(2).toInt(), 5);
+    }
+
+    // Eight copies of the contacts
+    QVector<ContactIdType> copies;
+    for (int i = 0; i < 7 * 7; ++i)
+        copies.append(cache.idAt(i % 7));
+    cache.insert(SeasideCache::FilterAll, 7, copies);
+
+    SeasideFilteredModel model;
+    QCOMPARE(model.rowCount(), 56);
+
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+
+    // Rows 5 and 6 of each copy
+    model.setFilterPattern("a");
+    QCOMPARE(model.rowCount(), 40);
+    QCOMPARE(resetSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 8);
+    for (int i = 0; i < 8; ++i) {
+        QCOMPARE(removedSpy.at(i).at(1).toInt(), 5 * i + 5);
+        QCOMPARE(removedSpy.at(i).at(2).toInt(), 5 * i + 6);
+    }
+
+    // Removing most of the rows in more than a few ranges resets the model
+    model.setFilterPattern(QString());
+    QCOMPARE(model.rowCount(), 56);
+    removedSpy.clear();
+
+    model.setFilterPattern("Robin");
+    QCOMPARE(model.rowCount(), 8);
+    QCOMPARE(resetSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(model.data(model.index(QModelIndex(), 7, 0), SeasideFilteredModel::ContactIdRole), idAt(6));
+
+    // As does removing rows in very many ranges, however few they are: seventy copies
+    model.setFilterPattern(QString());
+    copies.clear();
+    for (int i = 0; i < 62 * 7; ++i)
+        copies.append(cache.idAt(i % 7));
+    cache.insert(SeasideCache::FilterAll, 56, copies);
+    QCOMPARE(model.rowCount(), 490);
+    removedSpy.clear();
+    resetSpy.clear();
+
+    model.setFilterPattern("a");
+    QCOMPARE(model.rowCount(), 350);
+    QCOMPARE(resetSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 0);
+}
+
 void tst_SeasideFilteredModel::rowsInserted()
 {
     // Remove the exitsting index values
@@ -532,6 +721,60 @@ void tst_SeasideFilteredModel::dataChanged()
     QCOMPARE(changedSpy.count(), 0);
 }
 
+void tst_SeasideFilteredModel::changedRoles()
+{
+    SeasideFilteredModel model;
+    model.setFilterType(SeasideFilteredModel::FilterAll);
+
+    QCOMPARE(model.rowCount(), 7);
+
+    // Read the values of the item, as a delegate would
+    const QModelIndex index = model.index(QModelIndex(), 2, 0);
+    for (int role = SeasideFilteredModel::FirstNameRole; role <= SeasideFilteredModel::AccountPathsRole; ++role)
+        index.data(role);
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QSignalSpy changedSpy(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)));
+#else
+    QSignalSpy changedSpy(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+#endif
+
+    // Only the roles derived from the changed name are notified
+    cache.setFirstName(SeasideCache::FilterAll, 2, "Doug");
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>(), index);
+    QCOMPARE(changedSpy.at(0).at(1).value<QModelIndex>(), index);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QCOMPARE(changedSpy.at(0).at(2).value<QVector<int> >(), QVector<int>()
+            << Qt::DisplayRole
+            << SeasideFilteredModel::SectionBucketRole
+            << SeasideFilteredModel::MatchRangesRole
+            << SeasideFilteredModel::FirstNameRole);
+#endif
+    QCOMPARE(index.data(SeasideFilteredModel::FirstNameRole).toString(), QString("Doug"));
+
+    // Nothing is notified if no value changed
+    changedSpy.clear();
+    cache.setFirstName(SeasideCache::FilterAll, 2, "Doug");
+    QCOMPARE(changedSpy.count(), 0);
+
+    // The changes of an update are not notified again; a change reported without an update
+    // may affect any role
+    model.sourceDataChanged(2, 2);
+    QCOMPARE(changedSpy.count(), 1);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QVERIFY(changedSpy.at(0).at(2).value<QVector<int> >().isEmpty());
+#endif
+    changedSpy.clear();
+
+    // Every role may have changed for an item whose values were not read
+    cache.setFirstName(SeasideCache::FilterAll, 4, "Jay");
+    QCOMPARE(changedSpy.count(), 1);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QVERIFY(changedSpy.at(0).at(2).value<QVector<int> >().isEmpty());
+#endif
+}
+
 void tst_SeasideFilteredModel::data()
 {
     QModelIndex index;
@@ -586,6 +829,150 @@ void tst_SeasideFilteredModel::data()
     QCOMPARE(index.data(SeasideFilteredModel::LastNameRole).toString(), QString("Johns"));
     QCOMPARE(index.data(SeasideFilteredModel::SectionBucketRole).toString(), QString("J"));
     QCOMPARE(index.data(SeasideFilteredModel::AvatarRole).toUrl(), QUrl(QLatin1String("file:///cache/joe.jpg")));
+
+    // Values are kept with the item until it is updated
+    model.setFilterType(SeasideFilteredModel::FilterAll);
+    index = model.index(QModelIndex(), 0, 0);
+    QCOMPARE(index.data(SeasideFilteredModel::PhoneNumbersRole).toStringList(), QStringList() << "1234567");
+    QCOMPARE(index.data(SeasideFilteredModel::EmailAddressesRole).toStringList(), QStringList() << "aaronaa@example.com");
+    QCOMPARE(index.data(SeasideFilteredModel::FirstNameRole).toString(), QString("Aaron"));
+
+    cache.setFirstName(SeasideCache::FilterAll, 0, "Erin");
+    QCOMPARE(index.data(SeasideFilteredModel::FirstNameRole).toString(), QString("Erin"));
+    QCOMPARE(index.data(SeasideFilteredModel::LastNameRole).toString(), QString("Aaronson"));
+    QCOMPARE(index.data(SeasideFilteredModel::PhoneNumbersRole).toStringList(), QStringList() << "1234567");
+
+    // Other models share them
+    SeasideFilteredModel other;
+    QCOMPARE(other.index(QModelIndex(), 0, 0).data(SeasideFilteredModel::FirstNameRole).toString(), QString("Erin"));
+}
+
+void tst_SeasideFilteredModel::getRange()
+{
+    SeasideFilteredModel model;
+    const QStringList roles(QStringList() << "lastName" << "contactId" << "phoneNumbers");
+
+    QVariantList rows = model.getRange(2, 3, roles);
+    QCOMPARE(rows.count(), 3);
+    for (int i = 0; i < rows.count(); ++i) {
+        const QVariantList values(rows.at(i).toList());
+        QCOMPARE(values.count(), 3);
+        QCOMPARE(values.at(0), model.get(2 + i, SeasideFilteredModel::LastNameRole));
+        QCOMPARE(values.at(1), idAt(2 + i));
+    }
+    QCOMPARE(rows.at(0).toList().at(0).toString(), QString("Johns"));
+    QCOMPARE(rows.at(1).toList().at(2).toStringList(), QStringList() << "2345678");
+    QVERIFY(rows.at(0).toList().at(2).toStringList().isEmpty());
+
+    // The range is limited to the rows present
+    rows = model.getRange(5, 10, roles);
+    QCOMPARE(rows.count(), 2);
+    QCOMPARE(rows.at(1).toList().at(0).toString(), QString("Burchell"));
+    QVERIFY(model.getRange(7, 1, roles).isEmpty());
+
+    // And follows the filter: 0 4
+    model.setFilterPattern("aaronson");
+    rows = model.getRange(0, 10, QStringList() << "firstName");
+    QCOMPARE(rows.count(), 2);
+    QCOMPARE(rows.at(1).toList().at(0).toString(), QString("Jason"));
+}
+
+void tst_SeasideFilteredModel::prefetch()
+{
+    // The requests are batched by a timer, which needs an event loop
+    int argc = 0;
+    QCoreApplication application(argc, 0);
+
+    SeasideFilteredModel model;
+    for (int i = 0; i < 7; ++i)
+        cache.setContactState(i, SeasideCache::ContactPartial);
+    cache.setContactState(3, SeasideCache::ContactComplete);
+
+    // The visible rows are requested at once, except those already complete
+    model.prefetch(2, 4, 2);
+    QCOMPARE(cache.m_completionRequests, QList<quint32>() << cache.m_cache[2].iid << cache.m_cache[4].iid);
+
+    // Then the rows either side, nearest first
+    QTRY_COMPARE(cache.m_completionRequests.count(), 6);
+    QCOMPARE(cache.m_completionRequests.mid(2), QList<quint32>()
+             << cache.m_cache[5].iid << cache.m_cache[1].iid << cache.m_cache[6].iid << cache.m_cache[0].iid);
+
+    // Nothing is requested twice
+    cache.m_completionRequests.clear();
+    model.prefetch(0, 6, 7);
+    QTest::qWait(10);
+    QVERIFY(cache.m_completionRequests.isEmpty());
+
+    // Rows that are no longer near the visible rows when their turn comes are not requested
+    for (int i = 0; i < 7; ++i)
+        cache.setContactState(i, SeasideCache::ContactPartial);
+    model.prefetch(0, 0, 6);
+    model.prefetch(6, 6, 0);
+    QTest::qWait(10);
+    QCOMPARE(cache.m_completionRequests, QList<quint32>() << cache.m_cache[0].iid << cache.m_cache[6].iid);
+}
+
+void tst_SeasideFilteredModel::displayLabelOrder()
+{
+    // The rows outside the visible range are relabelled from a timer
+    int argc = 0;
+    QCoreApplication application(argc, 0);
+
+    SeasideFilteredModel model;
+    model.setFilterType(SeasideFilteredModel::FilterAll);
+
+    QCOMPARE(model.rowCount(), 7);
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QSignalSpy changedSpy(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)));
+#else
+    QSignalSpy changedSpy(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+#endif
+    QSignalSpy orderSpy(&model, SIGNAL(displayLabelOrderChanged()));
+
+    // Without visible rows, every row of a short list is notified at once
+    model.updateDisplayLabelOrder();
+    QCOMPARE(orderSpy.count(), 1);
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>(), model.index(QModelIndex(), 0, 0));
+    QCOMPARE(changedSpy.at(0).at(1).value<QModelIndex>(), model.index(QModelIndex(), 6, 0));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QCOMPARE(changedSpy.at(0).at(2).value<QVector<int> >(), QVector<int>()
+            << Qt::DisplayRole
+            << SeasideFilteredModel::SectionBucketRole);
+#endif
+
+    // The visible rows are notified first, then the rows after and before them
+    changedSpy.clear();
+    model.prefetch(2, 3);
+    model.updateDisplayLabelOrder();
+    QCOMPARE(orderSpy.count(), 2);
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>(), model.index(QModelIndex(), 2, 0));
+    QCOMPARE(changedSpy.at(0).at(1).value<QModelIndex>(), model.index(QModelIndex(), 3, 0));
+
+    QTRY_COMPARE(changedSpy.count(), 3);
+    QCOMPARE(changedSpy.at(1).at(0).value<QModelIndex>(), model.index(QModelIndex(), 4, 0));
+    QCOMPARE(changedSpy.at(1).at(1).value<QModelIndex>(), model.index(QModelIndex(), 6, 0));
+    QCOMPARE(changedSpy.at(2).at(0).value<QModelIndex>(), model.index(QModelIndex(), 0, 0));
+    QCOMPARE(changedSpy.at(2).at(1).value<QModelIndex>(), model.index(QModelIndex(), 1, 0));
+
+    // The match ranges are offsets into the labels, so they change with the order
+    model.setFilterPattern("Aaron");
+    QCOMPARE(model.rowCount(), 4);
+    model.prefetch(0, 3);
+    changedSpy.clear();
+    model.updateDisplayLabelOrder();
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(1).value<QModelIndex>(), model.index(QModelIndex(), 3, 0));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QCOMPARE(changedSpy.at(0).at(2).value<QVector<int> >(), QVector<int>()
+            << Qt::DisplayRole
+            << SeasideFilteredModel::SectionBucketRole
+            << SeasideFilteredModel::MatchRangesRole);
+#endif
+    QTest::qWait(10);
+    QCOMPARE(changedSpy.count(), 1);
 }
 
 void tst_SeasideFilteredModel::filterId()
@@ -633,106 +1020,962 @@ void tst_SeasideFilteredModel::filterId()
     model.setFilterPattern("Brooks");           QVERIFY(!model.filterId(cache.idAt(6)));
 }
 
-void tst_SeasideFilteredModel::searchByFirstNameCharacter()
+void tst_SeasideFilteredModel::searchIndex()
 {
     SeasideFilteredModel model;
-    model.setSearchByFirstNameCharacter(true);
-
-    model.setFilterPattern("R");
-    QCOMPARE(model.filterType(), SeasideFilteredModel::FilterAll);
-    QCOMPARE(model.rowCount(), 1);
 
-    model.setFilterPattern("A");
+    // 0 1 2 4
+    model.setFilterPattern("Aaron");
     QCOMPARE(model.rowCount(), 4);
 
-    model.setFilterPattern("r");    // not case-sensitive
-    QCOMPARE(model.rowCount(), 1);
-    model.setFilterPattern("aaron");    // only first letter counts
-    QCOMPARE(model.rowCount(), 4);
+    // 0 1 4
+    cache.setFirstName(SeasideCache::FilterAll, 2, "Doug");
+    QCOMPARE(model.rowCount(), 3);
 
-    SeasideCache::CacheItem *cacheItem = SeasideCache::existingItem(cache.idAt(0));
-    QString origName = cacheItem->contact.detail<QContactName>().firstName();
-    cache.setFirstName(SeasideCache::FilterAll, 0, "123");
-    model.setFilterPattern("#");    // non-letters
+    // The index must reflect the updated details
+    // 2
+    model.setFilterPattern("Dou");
     QCOMPARE(model.rowCount(), 1);
-
-    cache.setFirstName(SeasideCache::FilterAll, 0, origName);
-    model.setFilterPattern("");
-    QCOMPARE(model.rowCount(), 7);
-    model.setFilterPattern("#");
-    QCOMPARE(model.rowCount(), 0);
+    QCOMPARE(model.index(QModelIndex(), 0, 0).data(SeasideFilteredModel::FirstNameRole).toString(), QString::fromLatin1("Doug"));
+
+    // The index is shared with other models
+    SeasideFilteredModel other;
+    other.setFilterPattern("Doug Jo");
+    QCOMPARE(other.rowCount(), 1);
+    other.setFilterPattern("Aaron Jo");
+    QCOMPARE(other.rowCount(), 0);
+
+    // Both models share a single copy of the tokens
+    SeasideCache::CacheItem *item = SeasideCache::existingItem(cache.idAt(2));
+    QVERIFY(item);
+    int listeners = 0;
+    for (SeasideCache::ItemListener *listener = item->listeners; listener; listener = listener->next)
+        ++listeners;
+    QCOMPARE(listeners, 1);
+
+    const SeasideSearchIndex::Tokens tokens(QStringList() << "doug" << "johns");
+    QCOMPARE(tokens.count(), 2);
+    QCOMPARE(tokens.at(1), QString::fromLatin1("johns"));
+    QVERIFY(tokens.matches(QStringList() << "jo" << "d"));
+    QVERIFY(tokens.matches(QStringList() << "doug"));
+    QVERIFY(!tokens.matches(QStringList() << "dougl"));
+    QVERIFY(!tokens.matches(QStringList() << "doug" << "aa"));
+    QVERIFY(SeasideSearchIndex::Tokens().isEmpty());
 }
 
-void tst_SeasideFilteredModel::lookupById()
+void tst_SeasideFilteredModel::filterDiacritics()
 {
-    QModelIndex index;
-
     SeasideFilteredModel model;
-    model.setFilterType(SeasideFilteredModel::FilterAll);
 
-    QCOMPARE(model.rowCount(), 7);
+    // 4: Jose Aaronson, with an acute accent
+    cache.setFirstName(SeasideCache::FilterAll, 4, QString::fromUtf8("Jos\xc3\xa9"));
 
-    for (int i = 0; i < 7; ++i) {
-        // Verify the lookup by integer
-        QModelIndex index = model.index(QModelIndex(), i, 0);
+    model.setFilterPattern("Jose");                             QVERIFY(model.filterId(cache.idAt(4)));
+    model.setFilterPattern("JOSE");                             QVERIFY(model.filterId(cache.idAt(4)));
+    model.setFilterPattern(QString::fromUtf8("Jos\xc3\xa9"));   QVERIFY(model.filterId(cache.idAt(4)));
+    // decomposed form
+    model.setFilterPattern(QString::fromUtf8("JOSE\xcc\x81"));  QVERIFY(model.filterId(cache.idAt(4)));
+    model.setFilterPattern(QString::fromUtf8("Jos\xc3\xa8"));   QVERIFY(model.filterId(cache.idAt(4)));
+    model.setFilterPattern("Josh");                             QVERIFY(!model.filterId(cache.idAt(4)));
 
-        SeasidePerson *person = index.data(SeasideFilteredModel::PersonRole).value<SeasidePerson *>();
-        QCOMPARE(model.personById(person->id()), person);
+    model.setFilterPattern("jose");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.index(QModelIndex(), 0, 0).data(SeasideFilteredModel::LastNameRole).toString(), QString::fromLatin1("Aaronson"));
+}
+
+void tst_SeasideFilteredModel::splitWords()
+{
+    // The fast path must split exactly as QTextBoundaryFinder does; with Qt 4, where there is no
+    // fast path, this checks that splitWords() falls back to the boundary finder
+    const char *strings[] = {
+        "", " ", "Aaron", "Aaron Aaronson", "  Robin   Burchell ", "+358 40 123-4567", "(040) 123 4567",
+        "040.123.4567", "1,234.5", "aaronaa@example.com", "arthur1.johnz@example.org", "O'Neil", "Jr.",
+        "St. John", "a:b", "a;b", "1;2", "1:2", "a'1", "1'a", "..a..", "a.", ".a", "under_score", "#",
+        "x#y", "Tab\tSeparated", "Line\nBreak", "sip:joe@example.com", "a-b-c", "foo..bar", "a. b"
+    };
+    for (unsigned i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i) {
+        const QString string(QString::fromLatin1(strings[i]));
+        QCOMPARE(SeasideSearchIndex::splitWords(string), SeasideSearchIndex::splitBoundaryWords(string));
     }
 
-    // Verify that invalid values yield nothing
-    QCOMPARE(model.personById(0), static_cast<SeasidePerson *>(0));
-    QCOMPARE(model.personById(666), static_cast<SeasidePerson *>(0));
+    // Latin-1 letters and other scripts
+    const char *utf8Strings[] = {
+        "Jos\xc3\xa9", "Fran\xc3\xa7ois M\xc3\xbcller", "\xc3\x85sa \xc3\x96" "berg", "Stra\xc3\x9f" "e",
+        "2\xc3\x97" "3", "\xc2\xb5m", "\xd0\x98\xd0\xb2\xd0\xb0\xd0\xbd", "\xe4\xb8\xad\xe6\x96\x87",
+        "Jos\xc3\xa9 \xd0\x98\xd0\xb2\xd0\xb0\xd0\xbd"
+    };
+    for (unsigned i = 0; i < sizeof(utf8Strings) / sizeof(utf8Strings[0]); ++i) {
+        const QString string(QString::fromUtf8(utf8Strings[i]));
+        QCOMPARE(SeasideSearchIndex::splitWords(string), SeasideSearchIndex::splitBoundaryWords(string));
+    }
+
+    // Random strings of characters that are either side of the fast path's limits
+    const QString alphabet(QString::fromUtf8("aZ09 .,;:'-@+_#\t\xc3\xa9\xc3\x97\xc2\xb7"));
+    qsrand(1);
+    for (int i = 0; i < 2000; ++i) {
+        QString string;
+        const int length = qrand() % 12;
+        for (int j = 0; j < length; ++j)
+            string.append(alphabet.at(qrand() % alphabet.length()));
+        QCOMPARE(SeasideSearchIndex::splitWords(string), SeasideSearchIndex::splitBoundaryWords(string));
+    }
 }
 
-void tst_SeasideFilteredModel::requiredProperty()
+void tst_SeasideFilteredModel::fuzzySearch()
 {
     SeasideFilteredModel model;
-    QSignalSpy propertySpy(&model, SIGNAL(requiredPropertyChanged()));
-    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
-    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QCOMPARE(model.searchMode(), SeasideFilteredModel::PrefixSearch);
 
-    QCOMPARE(model.filterType(), SeasideFilteredModel::FilterAll);
-    QCOMPARE(model.requiredProperty(), int(SeasideFilteredModel::NoPropertyRequired));
-    QCOMPARE(model.rowCount(), 7);
+    model.setFilterPattern("Jonhs");
+    QCOMPARE(model.rowCount(), 0);
 
-    // 0 3 4 6
-    model.setRequiredProperty(SeasideFilteredModel::PhoneNumberRequired);
-    QCOMPARE(model.requiredProperty(), int(SeasideFilteredModel::PhoneNumberRequired));
-    QCOMPARE(propertySpy.count(), 1);
-    QCOMPARE(model.rowCount(), 4);
-    QCOMPARE(insertedSpy.count(), 0);
-    QCOMPARE(removedSpy.count(), 2);
-    QCOMPARE(removedSpy.at(0).at(1).value<int>(), 1);
-    QCOMPARE(removedSpy.at(0).at(2).value<int>(), 2);
-    QCOMPARE(removedSpy.at(1).at(1).value<int>(), 3);
-    QCOMPARE(removedSpy.at(1).at(2).value<int>(), 3);
+    QSignalSpy modeSpy(&model, SIGNAL(searchModeChanged()));
+    QSignalSpy countSpy(&model, SIGNAL(countChanged()));
 
-    propertySpy.clear();
-    removedSpy.clear();
+    // 2 3 5
+    model.setSearchMode(SeasideFilteredModel::FuzzySearch);
+    QCOMPARE(modeSpy.count(), 1);
+    QCOMPARE(countSpy.count(), 1);
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(2));
+    QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(3));
+    QCOMPARE(model.data(model.index(QModelIndex(), 2, 0), SeasideFilteredModel::ContactIdRole), idAt(5));
+    QVERIFY(model.filterId(cache.idAt(5)));
+    QVERIFY(!model.filterId(cache.idAt(6)));
+
+    // Short words must still match exactly
+    model.setFilterPattern("Jon");
+    QCOMPARE(model.rowCount(), 0);
 
-    // 0 1 2 3 4 5
-    model.setRequiredProperty(SeasideFilteredModel::EmailAddressRequired);
-    QCOMPARE(model.requiredProperty(), int(SeasideFilteredModel::EmailAddressRequired));
-    QCOMPARE(propertySpy.count(), 1);
-    QCOMPARE(model.rowCount(), 6);
-    QCOMPARE(insertedSpy.count(), 2);
-    QCOMPARE(insertedSpy.at(0).at(1).value<int>(), 1);
-    QCOMPARE(insertedSpy.at(0).at(2).value<int>(), 2);
-    QCOMPARE(insertedSpy.at(1).at(1).value<int>(), 5);
-    QCOMPARE(insertedSpy.at(1).at(2).value<int>(), 5);
-    QCOMPARE(removedSpy.count(), 1);
-    QCOMPARE(removedSpy.at(0).at(1).value<int>(), 5);
-    QCOMPARE(removedSpy.at(0).at(2).value<int>(), 5);
+    // Misspellings early in a short word share no gram with the name
+    // 2 3 5
+    model.setFilterPattern("Jhon");
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(2));
+    QVERIFY(model.filterId(cache.idAt(5)));
+    QVERIFY(!model.filterId(cache.idAt(4)));
 
-    propertySpy.clear();
-    insertedSpy.clear();
-    removedSpy.clear();
+    // 1 3
+    model.setFilterPattern("Arhtur");
+    QCOMPARE(model.rowCount(), 2);
 
-    // 0 1 2 3 4 5 6
-    model.setRequiredProperty(SeasideFilteredModel::EmailAddressRequired | SeasideFilteredModel::PhoneNumberRequired);
-    QCOMPARE(model.requiredProperty(), SeasideFilteredModel::EmailAddressRequired  | SeasideFilteredModel::PhoneNumberRequired);
-    QCOMPARE(propertySpy.count(), 1);
+    // 6
+    model.setFilterPattern("Robni");
+    QCOMPARE(model.rowCount(), 1);
+    model.setFilterPattern("Robni Burhcell");
+    QCOMPARE(model.rowCount(), 1);
+
+    // Misspellings in updated details are found too
+    cache.setFirstName(SeasideCache::FilterAll, 6, "Robert");
+    model.setFilterPattern("Rboert");
+    QCOMPARE(model.rowCount(), 1);
+    model.setFilterPattern("Rboe");
+    QCOMPARE(model.rowCount(), 1);
+
+    model.setSearchMode(SeasideFilteredModel::PrefixSearch);
+    QCOMPARE(model.rowCount(), 0);
+
+    QCOMPARE(SeasideSearchIndex::prefixDistance("jonh", "johnson", 1), 1);
+    QCOMPARE(SeasideSearchIndex::prefixDistance("jonh", "joh", 1), 1);
+    QCOMPARE(SeasideSearchIndex::prefixDistance("jonh", "jo", 1), 2);
+    QCOMPARE(SeasideSearchIndex::prefixDistance("aaron", "burchell", 2), 3);
+}
+
+void tst_SeasideFilteredModel::keypadSearch()
+{
+    SeasideFilteredModel model;
+    model.setSearchMode(SeasideFilteredModel::KeypadSearch);
+    QCOMPARE(model.searchMode(), SeasideFilteredModel::KeypadSearch);
+
+    // 2 3 4 5: Jason, Johns, Joe
+    model.setFilterPattern("5");
+    QCOMPARE(model.rowCount(), 4);
+
+    // 2 3 5
+    model.setFilterPattern("56");
+    QCOMPARE(model.rowCount(), 3);
+    model.setFilterPattern("5646");
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(2));
+
+    // 3
+    model.setRequiredProperty(SeasideFilteredModel::PhoneNumberRequired);
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(3));
+    model.setRequiredProperty(SeasideFilteredModel::NoPropertyRequired);
+
+    // 0 1 2 4
+    model.setFilterPattern("2276");
+    QCOMPARE(model.rowCount(), 4);
+
+    // Phone numbers: 4
+    model.setFilterPattern("345");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(4));
+
+    // 6
+    model.setFilterPattern("76246");
+    QCOMPARE(model.rowCount(), 1);
+    QVERIFY(model.filterId(cache.idAt(6)));
+    QVERIFY(!model.filterId(cache.idAt(5)));
+
+    // The digits follow changes to the contact
+    cache.setFirstName(SeasideCache::FilterAll, 6, "Robert");
+    QCOMPARE(model.rowCount(), 0);
+    model.setFilterPattern("762378");
+    QCOMPARE(model.rowCount(), 1);
+
+    QCOMPARE(SeasideSearchIndex::keypadDigits("johns"), QString::fromLatin1("56467"));
+    QCOMPARE(SeasideSearchIndex::keypadDigits("wxyz09"), QString::fromLatin1("999909"));
+    QVERIFY(SeasideSearchIndex::keypadDigits("o'neil").isEmpty());
+    QCOMPARE(SeasideSearchIndex::numberDigits("+358 (40) 123-4567"), QString::fromLatin1("358401234567"));
+}
+
+void tst_SeasideFilteredModel::numberSearch()
+{
+    SeasideFilteredModel model;
+
+    // Too short to be matched within numbers
+    model.setFilterPattern("45");
+    QCOMPARE(model.rowCount(), 0);
+
+    // 0 3 4
+    model.setFilterPattern("456");
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(0));
+    QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(3));
+    QCOMPARE(model.data(model.index(QModelIndex(), 2, 0), SeasideFilteredModel::ContactIdRole), idAt(4));
+    QVERIFY(model.filterId(cache.idAt(3)));
+    QVERIFY(!model.filterId(cache.idAt(6)));
+
+    // 3 4
+    model.setFilterPattern("5678");
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(3));
+
+    // 6
+    model.setFilterPattern("6543");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(6));
+
+    // Punctuation is ignored
+    // 0 3
+    model.setFilterPattern("234-56");
+    QCOMPARE(model.rowCount(), 2);
+
+    // Text patterns are not matched within numbers
+    model.setFilterPattern("456a");
+    QCOMPARE(model.rowCount(), 0);
+
+    // Updates that leave the numbers alone keep them indexed
+    // 6
+    cache.setFirstName(SeasideCache::FilterAll, 6, "Robert");
+    model.setFilterPattern("6543");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(6));
+
+    // Keypad input only matches the start of numbers
+    model.setSearchMode(SeasideFilteredModel::KeypadSearch);
+    model.setFilterPattern("456");
+    QCOMPARE(model.rowCount(), 0);
+}
+
+void tst_SeasideFilteredModel::relevanceOrder()
+{
+    // 0: Joey Aaronson
+    cache.setFirstName(SeasideCache::FilterAll, 0, "Joey");
+
+    SeasideFilteredModel model;
+    QSignalSpy orderSpy(&model, SIGNAL(sortOrderChanged()));
+    QSignalSpy movedSpy(&model, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)));
+
+    model.setSortOrder(SeasideFilteredModel::RelevanceOrder);
+    QCOMPARE(model.sortOrder(), SeasideFilteredModel::RelevanceOrder);
+    QCOMPARE(orderSpy.count(), 1);
+
+    // The whole name ranks above the prefix
+    // 5 0
+    model.setFilterPattern("Joe");
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(5));
+    QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(0));
+    QCOMPARE(movedSpy.count(), 1);
+
+    // 0
+    model.setFilterPattern("Joey");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(0));
+
+    // 5 0
+    model.setFilterPattern("Joe");
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(5));
+
+    // Equally relevant matches stay in reference order
+    // 0 5
+    cache.setFirstName(SeasideCache::FilterAll, 5, "Joel");
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(0));
+    QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(5));
+
+    // 5 0
+    cache.setFirstName(SeasideCache::FilterAll, 5, "Joe");
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(5));
+
+    // 0 5
+    model.setSortOrder(SeasideFilteredModel::ReferenceOrder);
+    QCOMPARE(orderSpy.count(), 2);
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(0));
+    QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(5));
+
+    // The reference order is kept by later refinements
+    // 0
+    model.setFilterPattern("Joey");
+    QCOMPARE(model.rowCount(), 1);
+
+    model.setSortOrder(SeasideFilteredModel::RelevanceOrder);
+    model.setFilterPattern(QString());
+    QCOMPARE(model.rowCount(), 7);
+    QCOMPARE(model.data(model.index(QModelIndex(), 6, 0), SeasideFilteredModel::ContactIdRole), idAt(6));
+}
+
+void tst_SeasideFilteredModel::maxResults()
+{
+    SeasideFilteredModel model;
+    QSignalSpy moreSpy(&model, SIGNAL(hasMoreResultsChanged()));
+
+    model.setMaxResults(2);
+    QCOMPARE(model.maxResults(), 2);
+    QCOMPARE(model.hasMoreResults(), false);
+
+    // Unfiltered models are not limited
+    QCOMPARE(model.rowCount(), 7);
+
+    // 0 1 of 0 1 2 4
+    model.setFilterPattern("Aaron");
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.hasMoreResults(), true);
+    QCOMPARE(moreSpy.count(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(1));
+
+    // A view scrolled to the end doesn't lift the limit
+    QCOMPARE(model.canFetchMore(QModelIndex()), false);
+    model.fetchMore(QModelIndex());
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.hasMoreResults(), true);
+
+    // 0 1 2 4
+    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    model.fetchMoreResults();
+    QCOMPARE(model.rowCount(), 4);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.at(0).at(1).toInt(), 2);
+    QCOMPARE(insertedSpy.at(0).at(2).toInt(), 3);
+    QCOMPARE(model.data(model.index(QModelIndex(), 3, 0), SeasideFilteredModel::ContactIdRole), idAt(4));
+    QCOMPARE(model.hasMoreResults(), false);
+
+    // 2
+    model.setFilterPattern("Aaron Jo");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.hasMoreResults(), false);
+
+    // 0 3 of 0 3 4 6
+    model.setFilterPattern(QString());
+    model.setRequiredProperty(SeasideFilteredModel::PhoneNumberRequired);
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(3));
+    QCOMPARE(model.hasMoreResults(), true);
+
+    // The most relevant matches are kept when ranking
+    // 5 of 5 0
+    cache.setFirstName(SeasideCache::FilterAll, 0, "Joey");
+    model.setRequiredProperty(SeasideFilteredModel::NoPropertyRequired);
+    model.setSortOrder(SeasideFilteredModel::RelevanceOrder);
+    model.setMaxResults(1);
+    model.setFilterPattern("Joe");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(5));
+    QCOMPARE(model.hasMoreResults(), true);
+
+    model.setMaxResults(0);
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.hasMoreResults(), false);
+}
+
+void tst_SeasideFilteredModel::selectiveChanges()
+{
+    // 0: Joey Aaronson
+    cache.setFirstName(SeasideCache::FilterAll, 0, "Joey");
+
+    {
+        SeasideFilteredModel model;
+        model.setSortOrder(SeasideFilteredModel::RelevanceOrder);
+
+        // 5 0
+        model.setFilterPattern("Joe");
+        QCOMPARE(model.rowCount(), 2);
+
+        QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+        QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+        QSignalSpy movedSpy(&model, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)));
+        QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+        QSignalSpy changedSpy(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+        // A less relevant match moves within the list: 0 5
+        cache.setFirstName(SeasideCache::FilterAll, 5, "Joel");
+        QCOMPARE(movedSpy.count(), 1);
+        QCOMPARE(movedSpy.at(0).at(1).toInt(), 0);
+        QCOMPARE(movedSpy.at(0).at(2).toInt(), 0);
+        QCOMPARE(movedSpy.at(0).at(4).toInt(), 2);
+        QCOMPARE(changedSpy.count(), 1);
+        QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>().row(), 1);
+        QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(0));
+        QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(5));
+
+        // out of it: 0
+        cache.setFirstName(SeasideCache::FilterAll, 5, "Bob");
+        QCOMPARE(removedSpy.count(), 1);
+        QCOMPARE(removedSpy.at(0).at(1).toInt(), 1);
+        QCOMPARE(removedSpy.at(0).at(2).toInt(), 1);
+        QCOMPARE(model.rowCount(), 1);
+
+        // and back into it, above the less relevant match: 5 0
+        cache.setFirstName(SeasideCache::FilterAll, 5, "Joe");
+        QCOMPARE(insertedSpy.count(), 1);
+        QCOMPARE(insertedSpy.at(0).at(1).toInt(), 0);
+        QCOMPARE(insertedSpy.at(0).at(2).toInt(), 0);
+        QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(5));
+        QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(0));
+
+        QCOMPARE(movedSpy.count(), 1);
+        QCOMPARE(removedSpy.count(), 1);
+        QCOMPARE(resetSpy.count(), 0);
+    }
+
+    SeasideFilteredModel model;
+    model.setMaxResults(3);
+
+    // 0 1 2 of 0 1 2 4
+    model.setFilterPattern("Aaron");
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.hasMoreResults(), true);
+
+    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QSignalSpy resetSpy(&model, SIGNAL(modelReset()));
+    QSignalSpy changedSpy(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+    // A match leaving the list is replaced by the first match beyond the limit: 0 1 4
+    cache.setFirstName(SeasideCache::FilterAll, 2, "Bob");
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(removedSpy.at(0).at(1).toInt(), 2);
+    QCOMPARE(removedSpy.at(0).at(2).toInt(), 2);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.at(0).at(1).toInt(), 2);
+    QCOMPARE(insertedSpy.at(0).at(2).toInt(), 2);
+    QCOMPARE(model.data(model.index(QModelIndex(), 2, 0), SeasideFilteredModel::ContactIdRole), idAt(4));
+    QCOMPARE(model.hasMoreResults(), false);
+
+    // A match entering the list pushes the last row beyond the limit: 0 1 2
+    insertedSpy.clear();
+    removedSpy.clear();
+    cache.setFirstName(SeasideCache::FilterAll, 2, "Aaron");
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.at(0).at(1).toInt(), 2);
+    QCOMPARE(insertedSpy.at(0).at(2).toInt(), 2);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(removedSpy.at(0).at(1).toInt(), 3);
+    QCOMPARE(removedSpy.at(0).at(2).toInt(), 3);
+    QCOMPARE(model.data(model.index(QModelIndex(), 2, 0), SeasideFilteredModel::ContactIdRole), idAt(2));
+    QCOMPARE(model.hasMoreResults(), true);
+
+    // A match changing within the list stays in place
+    insertedSpy.clear();
+    removedSpy.clear();
+    changedSpy.clear();
+    cache.setFirstName(SeasideCache::FilterAll, 1, "Aaro");
+    QCOMPARE(insertedSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>().row(), 1);
+    QCOMPARE(changedSpy.at(0).at(1).value<QModelIndex>().row(), 1);
+    QCOMPARE(resetSpy.count(), 0);
+}
+
+void tst_SeasideFilteredModel::matchRanges()
+{
+    SeasideFilteredModel model;
+    QSignalSpy changedSpy(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+    QVERIFY(model.roleNames().values().contains("matchRanges"));
+
+    // 0 1 2 4
+    // Ranges nobody has read are not notified
+    model.setFilterPattern("aar");
+    QCOMPARE(model.rowCount(), 4);
+    QCOMPARE(changedSpy.count(), 0);
+
+    QVariantList ranges = model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::MatchRangesRole).toList();
+    QCOMPARE(ranges.count(), 2);
+    QCOMPARE(ranges.at(0).toMap().value("start").toInt(), 0);
+    QCOMPARE(ranges.at(0).toMap().value("length").toInt(), 3);
+    QCOMPARE(ranges.at(1).toMap().value("start").toInt(), 6);
+    QCOMPARE(ranges.at(1).toMap().value("length").toInt(), 3);
+
+    ranges = model.data(model.index(QModelIndex(), 3, 0), SeasideFilteredModel::MatchRangesRole).toList();
+    QCOMPARE(ranges.count(), 1);
+    QCOMPARE(ranges.at(0).toMap().value("start").toInt(), 6);
+    QCOMPARE(ranges.at(0).toMap().value("length").toInt(), 3);
+
+    // The spans change with the pattern, for the rows they were read for: 0 1 2 4
+    changedSpy.clear();
+    model.setFilterPattern("aaron");
+    QCOMPARE(model.rowCount(), 4);
+    QCOMPARE(changedSpy.count(), 2);
+    QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>(), model.index(QModelIndex(), 0, 0));
+    QCOMPARE(changedSpy.at(0).at(1).value<QModelIndex>(), model.index(QModelIndex(), 0, 0));
+    QCOMPARE(changedSpy.at(1).at(0).value<QModelIndex>(), model.index(QModelIndex(), 3, 0));
+    QCOMPARE(changedSpy.at(1).at(1).value<QModelIndex>(), model.index(QModelIndex(), 3, 0));
+
+    ranges = model.data(model.index(QModelIndex(), 3, 0), SeasideFilteredModel::MatchRangesRole).toList();
+    QCOMPARE(ranges.count(), 1);
+    QCOMPARE(ranges.at(0).toMap().value("start").toInt(), 6);
+    QCOMPARE(ranges.at(0).toMap().value("length").toInt(), 5);
+
+    // Rows that are filtered out are not notified: 2 3 5
+    changedSpy.clear();
+    model.setFilterPattern("johns");
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(changedSpy.count(), 0);
+
+    ranges = model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::MatchRangesRole).toList();
+    QCOMPARE(ranges.count(), 1);
+    QCOMPARE(ranges.at(0).toMap().value("start").toInt(), 6);
+    QCOMPARE(ranges.at(0).toMap().value("length").toInt(), 5);
+
+    // And with the display label
+    cache.setFirstName(SeasideCache::FilterAll, 2, "Johnny");
+    ranges = model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::MatchRangesRole).toList();
+    QCOMPARE(ranges.count(), 1);
+    QCOMPARE(ranges.at(0).toMap().value("start").toInt(), 7);
+
+    // Keypad digits span the letters they were typed for
+    model.setSearchMode(SeasideFilteredModel::KeypadSearch);
+    model.setFilterPattern("5646");
+    QCOMPARE(model.rowCount(), 3);
+
+    ranges = model.data(model.index(QModelIndex(), 2, 0), SeasideFilteredModel::MatchRangesRole).toList();
+    QCOMPARE(ranges.count(), 1);
+    QCOMPARE(ranges.at(0).toMap().value("start").toInt(), 4);
+    QCOMPARE(ranges.at(0).toMap().value("length").toInt(), 4);
+
+    // Nothing is matched without a pattern
+    model.setFilterPattern(QString());
+    QVERIFY(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::MatchRangesRole).toList().isEmpty());
+}
+
+void tst_SeasideFilteredModel::sharedResults()
+{
+    SeasideFilteredModel model1;
+    SeasideFilteredModel model2;
+
+    // 0 1 2 4
+    model1.setFilterPattern("aar");
+    model2.setFilterPattern("AAR");
+    QCOMPARE(model1.rowCount(), 4);
+    QCOMPARE(model2.rowCount(), 4);
+    for (int i = 0; i < 4; ++i) {
+        QCOMPARE(model2.data(model2.index(QModelIndex(), i, 0), SeasideFilteredModel::ContactIdRole),
+                 model1.data(model1.index(QModelIndex(), i, 0), SeasideFilteredModel::ContactIdRole));
+    }
+
+    // Both models follow a change to a matched contact: 0 2 4
+    cache.setFirstName(SeasideCache::FilterAll, 1, "Bob");
+    QCOMPARE(model1.rowCount(), 3);
+    QCOMPARE(model2.rowCount(), 3);
+
+    // A model sharing the filter later sees the current matches
+    SeasideFilteredModel model3;
+    model3.setFilterPattern("aar");
+    QCOMPARE(model3.rowCount(), 3);
+
+    // 0 4
+    model1.setFilterPattern("aaronson");
+    model3.setFilterPattern("aaronson");
+    QCOMPARE(model1.rowCount(), 2);
+    QCOMPARE(model3.rowCount(), 2);
+    QCOMPARE(model3.data(model3.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(0));
+    QCOMPARE(model3.data(model3.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(4));
+
+    SeasideSearchIndex *index = SeasideSearchIndex::acquire();
+    const QVector<ContactIdType> &reference(*SeasideCache::contacts(SeasideCache::FilterAll));
+    const SeasideSearchIndex::ResultKey key = { SeasideFilteredModel::FilterAll, 0, 0, QStringList() << "x", QString() };
+
+    QBitArray matches;
+    index->acquireResult(key);
+    QVERIFY(!index->cachedResult(key, reference, &matches));
+    index->storeResult(key, reference, QBitArray(reference.count(), true));
+    QVERIFY(index->cachedResult(key, reference, &matches));
+    QCOMPARE(matches.count(true), reference.count());
+
+    // The results are invalidated by changes to the indexed items
+    cache.setFirstName(SeasideCache::FilterAll, 0, "Erin");
+    QVERIFY(!index->cachedResult(key, reference, &matches));
+
+    // But not by updates that leave the indexed details alone
+    index->storeResult(key, reference, QBitArray(reference.count(), true));
+    cache.setFirstName(SeasideCache::FilterAll, 0, "Erin");
+    QVERIFY(index->cachedResult(key, reference, &matches));
+
+    // And discarded once nothing is interested in them
+    index->releaseResult(key);
+    index->storeResult(key, reference, QBitArray(reference.count(), true));
+    QVERIFY(!index->cachedResult(key, reference, &matches));
+    index->release();
+}
+
+void tst_SeasideFilteredModel::query()
+{
+    SeasideFilteredModel model;
+    QCOMPARE(model.rowCount(), 7);
+
+    QSignalSpy querySpy(&model, SIGNAL(queryChanged()));
+
+    // 0 1 2
+    model.setQuery("email:@example.com");
+    QCOMPARE(querySpy.count(), 1);
+    QCOMPARE(model.query(), QString::fromLatin1("email:@example.com"));
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.data(model.index(QModelIndex(), 2, 0), SeasideFilteredModel::ContactIdRole), idAt(2));
+
+    // 3
+    model.setQuery("email:EXAMPLE.ORG");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(3));
+
+    // 4 5 6
+    model.setQuery("email:examplez OR phone:987");
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.data(model.index(QModelIndex(), 2, 0), SeasideFilteredModel::ContactIdRole), idAt(6));
+
+    // 3 6
+    model.setQuery("has:phone -name:aaron");
+    QCOMPARE(model.rowCount(), 2);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(3));
+    QCOMPARE(model.data(model.index(QModelIndex(), 1, 0), SeasideFilteredModel::ContactIdRole), idAt(6));
+
+    // The query applies in addition to the pattern: 3
+    model.setFilterPattern("john");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(3));
+
+    // 3 6
+    model.setFilterPattern(QString());
+    QCOMPARE(model.rowCount(), 2);
+
+    // Words are matched like the pattern, and AND is implied: 0 1 2 4
+    model.setQuery("aaron AND has:email");
+    QCOMPARE(model.rowCount(), 4);
+    model.setQuery("aaron has:email -\"johns\"");
+    QCOMPARE(model.rowCount(), 3);
+
+    // Quoted values may contain white space, and operators are only recognized unquoted: 0 1 6
+    model.setQuery("name:\"aaron a\" OR name:robin");
+    QCOMPARE(model.rowCount(), 3);
+    model.setQuery("name:\"aaron a\" \"OR\" name:robin");
+    QCOMPARE(model.rowCount(), 0);
+
+    // The matches follow changes to the contacts
+    model.setQuery("name:jason");
+    QCOMPARE(model.rowCount(), 1);
+    cache.setFirstName(SeasideCache::FilterAll, 4, "Jay");
+    QCOMPARE(model.rowCount(), 0);
+    cache.setFirstName(SeasideCache::FilterAll, 1, "Jason");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(1));
+
+    // Terms that can't be matched are ignored
+    model.setQuery("OR AND -");
+    QCOMPARE(model.rowCount(), 7);
+
+    // Unknown fields and invalid values are matched as words, and don't widen the result
+    model.setQuery("has:phone foo:bar");
+    QCOMPARE(model.rowCount(), 0);
+    model.setQuery("has:fax favorite:maybe");
+    QCOMPARE(model.rowCount(), 0);
+
+    // 4
+    model.setQuery("has:phone jason:");
+    QCOMPARE(model.rowCount(), 1);
+    QCOMPARE(model.data(model.index(QModelIndex(), 0, 0), SeasideFilteredModel::ContactIdRole), idAt(4));
+
+    model.setQuery(QString());
+    QCOMPARE(model.rowCount(), 7);
+}
+
+void tst_SeasideFilteredModel::asynchronous()
+{
+    // Results are delivered through the event loop, which the test doesn't otherwise have.
+    int argc = 0;
+    QCoreApplication application(argc, 0);
+
+    SeasideFilteredModel model;
+    model.setAsynchronous(true);
+    QCOMPARE(model.isAsynchronous(), true);
+
+    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+
+    // The rows are unchanged until the job completes
+    model.setFilterPattern("Aaron");
+    QCOMPARE(model.filterPattern(), QString::fromLatin1("Aaron"));
+    QCOMPARE(model.rowCount(), 7);
+
+    // The job for "Aaron" is superseded before its results are applied
+    // 0 4
+    model.setFilterPattern("Aaronson");
+    QTRY_COMPARE(model.rowCount(), 2);
+    QCOMPARE(insertedSpy.count(), 0);
+    QCOMPARE(model.index(QModelIndex(), 0, 0).data(SeasideFilteredModel::FirstNameRole).toString(), QString::fromLatin1("Aaron"));
+    QCOMPARE(model.index(QModelIndex(), 1, 0).data(SeasideFilteredModel::FirstNameRole).toString(), QString::fromLatin1("Jason"));
+
+    int removed = 0;
+    for (int i = 0; i < removedSpy.count(); ++i)
+        removed += removedSpy.at(i).at(2).toInt() - removedSpy.at(i).at(1).toInt() + 1;
+    QCOMPARE(removed, 5);
+
+    // 0 1 2 4
+    insertedSpy.clear();
+    removedSpy.clear();
+    model.setFilterPattern("Aaro");
+    QTRY_COMPARE(model.rowCount(), 4);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(model.index(QModelIndex(), 2, 0).data(SeasideFilteredModel::LastNameRole).toString(), QString::fromLatin1("Johns"));
+
+    // A refinement matches only the current rows
+    // 0 4
+    insertedSpy.clear();
+    removedSpy.clear();
+    model.setFilterPattern("Aaronso");
+    QTRY_COMPARE(model.rowCount(), 2);
+    QCOMPARE(insertedSpy.count(), 0);
+    QCOMPARE(model.index(QModelIndex(), 1, 0).data(SeasideFilteredModel::FirstNameRole).toString(), QString::fromLatin1("Jason"));
+
+    // and the previous results are restored when it is undone
+    // 0 1 2 4
+    removedSpy.clear();
+    model.setFilterPattern("Aaro");
+    QTRY_COMPARE(model.rowCount(), 4);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(model.index(QModelIndex(), 1, 0).data(SeasideFilteredModel::LastNameRole).toString(), QString::fromLatin1("Arthur"));
+
+    // A contact changed while a job is running is matched again
+    // 5 6
+    model.setFilterPattern("Robin");
+    cache.setFirstName(SeasideCache::FilterAll, 5, "Robin");
+    QTRY_COMPARE(model.rowCount(), 2);
+    QCOMPARE(model.index(QModelIndex(), 0, 0).data(SeasideFilteredModel::LastNameRole).toString(), QString::fromLatin1("Johns"));
+    QCOMPARE(model.index(QModelIndex(), 1, 0).data(SeasideFilteredModel::LastNameRole).toString(), QString::fromLatin1("Burchell"));
+
+    // Leaving asynchronous mode completes any outstanding filter immediately
+    // 2 3 5
+    model.setFilterPattern("Johns");
+    model.setAsynchronous(false);
+    QCOMPARE(model.rowCount(), 3);
+
+    // Removing the filter is always immediate
+    model.setAsynchronous(true);
+    model.setFilterPattern(QString());
+    QCOMPARE(model.rowCount(), 7);
+}
+
+void tst_SeasideFilteredModel::parallel()
+{
+    SeasideFilteredModel parallel;
+    QCOMPARE(parallel.isParallel(), true);
+
+    SeasideFilteredModel sequential;
+    sequential.setParallel(false);
+    QCOMPARE(sequential.isParallel(), false);
+
+    const char *patterns[] = { "a", "aa", "Aaron", "Jo", "example", "1234567", "Robin B", "x" };
+    for (unsigned i = 0; i < sizeof(patterns) / sizeof(patterns[0]); ++i) {
+        parallel.setFilterPattern(QLatin1String(patterns[i]));
+        sequential.setFilterPattern(QLatin1String(patterns[i]));
+
+        QCOMPARE(parallel.rowCount(), sequential.rowCount());
+        for (int row = 0; row < parallel.rowCount(); ++row) {
+            QCOMPARE(parallel.index(QModelIndex(), row, 0).data(SeasideFilteredModel::ContactIdRole),
+                     sequential.index(QModelIndex(), row, 0).data(SeasideFilteredModel::ContactIdRole));
+        }
+    }
+
+    // Enough contacts to be tokenized across the thread pool
+    QList<QContact> contacts;
+    for (int i = 0; i < 100; ++i)
+        contacts.append(SeasideCache::existingItem(cache.idAt(i % 7))->contact);
+
+    const QList<QStringList> parallelTokens(SeasideSearchIndex::contactTokens(contacts, true));
+    const QList<QStringList> sequentialTokens(SeasideSearchIndex::contactTokens(contacts, false));
+    QCOMPARE(parallelTokens.count(), contacts.count());
+    QCOMPARE(parallelTokens, sequentialTokens);
+}
+
+void tst_SeasideFilteredModel::filterDelay()
+{
+    // The delayed filters are applied through the event loop, which the test doesn't otherwise have.
+    int argc = 0;
+    QCoreApplication application(argc, 0);
+
+    SeasideFilteredModel model;
+    model.setFilterDelay(50);
+    QCOMPARE(model.filterDelay(), 50);
+
+    QSignalSpy patternSpy(&model, SIGNAL(filterPatternChanged()));
+    QSignalSpy propertySpy(&model, SIGNAL(requiredPropertyChanged()));
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+
+    // The pattern is reported immediately, but the rows only change once
+    model.setFilterPattern("A");
+    model.setFilterPattern("Aa");
+    model.setFilterPattern("Aar");
+    model.setFilterPattern("Aaron");
+    QCOMPARE(model.filterPattern(), QString::fromLatin1("Aaron"));
+    QCOMPARE(patternSpy.count(), 4);
+    QCOMPARE(model.rowCount(), 7);
+
+    // 0 1 2 4
+    QTRY_COMPARE(model.rowCount(), 4);
+    QCOMPARE(patternSpy.count(), 4);
+    QCOMPARE(removedSpy.count(), 2);
+    QCOMPARE(removedSpy.at(0).at(1).value<int>(), 3);
+    QCOMPARE(removedSpy.at(0).at(2).value<int>(), 3);
+    QCOMPARE(removedSpy.at(1).at(1).value<int>(), 4);
+    QCOMPARE(removedSpy.at(1).at(2).value<int>(), 5);
+
+    // The property is combined with the pending pattern
+    // 0 4
+    model.setFilterPattern("Aaronson");
+    model.setRequiredProperty(SeasideFilteredModel::PhoneNumberRequired);
+    QCOMPARE(model.filterPattern(), QString::fromLatin1("Aaronson"));
+    QCOMPARE(model.requiredProperty(), int(SeasideFilteredModel::PhoneNumberRequired));
+    QCOMPARE(propertySpy.count(), 1);
+    QTRY_COMPARE(model.rowCount(), 2);
+    QCOMPARE(propertySpy.count(), 1);
+
+    // Removing the delay applies any pending change
+    // 2 3 5
+    model.setRequiredProperty(SeasideFilteredModel::NoPropertyRequired);
+    model.setFilterPattern("Jo");
+    model.setFilterDelay(0);
+    QCOMPARE(model.rowCount(), 3);
+
+    // 0 1 2 3 4 5 6
+    model.setFilterPattern(QString());
+    QCOMPARE(model.rowCount(), 7);
+}
+
+void tst_SeasideFilteredModel::searchByFirstNameCharacter()
+{
+    SeasideFilteredModel model;
+    model.setSearchByFirstNameCharacter(true);
+
+    model.setFilterPattern("R");
+    QCOMPARE(model.filterType(), SeasideFilteredModel::FilterAll);
+    QCOMPARE(model.rowCount(), 1);
+
+    model.setFilterPattern("A");
+    QCOMPARE(model.rowCount(), 4);
+
+    model.setFilterPattern("r");    // not case-sensitive
+    QCOMPARE(model.rowCount(), 1);
+    model.setFilterPattern("aaron");    // only first letter counts
+    QCOMPARE(model.rowCount(), 4);
+
+    SeasideCache::CacheItem *cacheItem = SeasideCache::existingItem(cache.idAt(0));
+    QString origName = cacheItem->contact.detail<QContactName>().firstName();
+    cache.setFirstName(SeasideCache::FilterAll, 0, "123");
+    model.setFilterPattern("#");    // non-letters
+    QCOMPARE(model.rowCount(), 1);
+
+    cache.setFirstName(SeasideCache::FilterAll, 0, origName);
+    model.setFilterPattern("");
+    QCOMPARE(model.rowCount(), 7);
+    model.setFilterPattern("#");
+    QCOMPARE(model.rowCount(), 0);
+}
+
+void tst_SeasideFilteredModel::lookupById()
+{
+    QModelIndex index;
+
+    SeasideFilteredModel model;
+    model.setFilterType(SeasideFilteredModel::FilterAll);
+
+    QCOMPARE(model.rowCount(), 7);
+
+    for (int i = 0; i < 7; ++i) {
+        // Verify the lookup by integer
+        QModelIndex index = model.index(QModelIndex(), i, 0);
+
+        SeasidePerson *person = index.data(SeasideFilteredModel::PersonRole).value<SeasidePerson *>();
+        QCOMPARE(model.personById(person->id()), person);
+    }
+
+    // Verify that invalid values yield nothing
+    QCOMPARE(model.personById(0), static_cast<SeasidePerson *>(0));
+    QCOMPARE(model.personById(666), static_cast<SeasidePerson *>(0));
+}
+
+void tst_SeasideFilteredModel::requiredProperty()
+{
+    SeasideFilteredModel model;
+    QSignalSpy propertySpy(&model, SIGNAL(requiredPropertyChanged()));
+    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+
+    QCOMPARE(model.filterType(), SeasideFilteredModel::FilterAll);
+    QCOMPARE(model.requiredProperty(), int(SeasideFilteredModel::NoPropertyRequired));
+    QCOMPARE(model.rowCount(), 7);
+
+    // 0 3 4 6
+    model.setRequiredProperty(SeasideFilteredModel::PhoneNumberRequired);
+    QCOMPARE(model.requiredProperty(), int(SeasideFilteredModel::PhoneNumberRequired));
+    QCOMPARE(propertySpy.count(), 1);
+    QCOMPARE(model.rowCount(), 4);
+    QCOMPARE(insertedSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 2);
+    QCOMPARE(removedSpy.at(0).at(1).value<int>(), 1);
+    QCOMPARE(removedSpy.at(0).at(2).value<int>(), 2);
+    QCOMPARE(removedSpy.at(1).at(1).value<int>(), 3);
+    QCOMPARE(removedSpy.at(1).at(2).value<int>(), 3);
+
+    propertySpy.clear();
+    removedSpy.clear();
+
+    // 0 1 2 3 4 5
+    model.setRequiredProperty(SeasideFilteredModel::EmailAddressRequired);
+    QCOMPARE(model.requiredProperty(), int(SeasideFilteredModel::EmailAddressRequired));
+    QCOMPARE(propertySpy.count(), 1);
+    QCOMPARE(model.rowCount(), 6);
+    QCOMPARE(insertedSpy.count(), 2);
+    QCOMPARE(insertedSpy.at(0).at(1).value<int>(), 1);
+    QCOMPARE(insertedSpy.at(0).at(2).value<int>(), 2);
+    QCOMPARE(insertedSpy.at(1).at(1).value<int>(), 5);
+    QCOMPARE(insertedSpy.at(1).at(2).value<int>(), 5);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(removedSpy.at(0).at(1).value<int>(), 5);
+    QCOMPARE(removedSpy.at(0).at(2).value<int>(), 5);
+
+    propertySpy.clear();
+    insertedSpy.clear();
+    removedSpy.clear();
+
+    // 0 1 2 3 4 5 6
+    model.setRequiredProperty(SeasideFilteredModel::EmailAddressRequired | SeasideFilteredModel::PhoneNumberRequired);
+    QCOMPARE(model.requiredProperty(), SeasideFilteredModel::EmailAddressRequired  | SeasideFilteredModel::PhoneNumberRequired);
+    QCOMPARE(propertySpy.count(), 1);
     QCOMPARE(model.rowCount(), 7);
     QCOMPARE(insertedSpy.count(), 1);
     QCOMPARE(insertedSpy.at(0).at(1).value<int>(), 6);
@@ -766,6 +2009,40 @@ void tst_SeasideFilteredModel::requiredProperty()
     QCOMPARE(removedSpy.count(), 0);
 }
 
+void tst_SeasideFilteredModel::requiredPropertyRows()
+{
+    SeasideFilteredModel model;
+
+    // 0 3 4 6
+    model.setRequiredProperty(SeasideFilteredModel::PhoneNumberRequired);
+    QCOMPARE(model.rowCount(), 4);
+
+    // 0 4 6
+    cache.remove(SeasideCache::FilterAll, 3, 1);
+    QCOMPARE(model.rowCount(), 3);
+
+    // The property rows follow the removal
+    // 0 1 2 4 5
+    model.setRequiredProperty(SeasideFilteredModel::EmailAddressRequired);
+    QCOMPARE(model.rowCount(), 5);
+    QCOMPARE(model.index(QModelIndex(), 3, 0).data(SeasideFilteredModel::FirstNameRole).toString(), QString::fromLatin1("Jason"));
+
+    // 0 1 2 3 4 5
+    cache.insert(SeasideCache::FilterAll, 3, QVector<ContactIdType>() << cache.idAt(3));
+    QCOMPARE(model.rowCount(), 6);
+
+    // And the insertion
+    // 0 3 4 6
+    model.setRequiredProperty(SeasideFilteredModel::PhoneNumberRequired);
+    QCOMPARE(model.rowCount(), 4);
+    QCOMPARE(model.index(QModelIndex(), 1, 0).data(SeasideFilteredModel::FirstNameRole).toString(), QString::fromLatin1("Arthur"));
+    QCOMPARE(model.index(QModelIndex(), 3, 0).data(SeasideFilteredModel::FirstNameRole).toString(), QString::fromLatin1("Robin"));
+
+    // 0 1 2 3 4 5 6
+    model.setRequiredProperty(SeasideFilteredModel::PhoneNumberRequired | SeasideFilteredModel::EmailAddressRequired);
+    QCOMPARE(model.rowCount(), 7);
+}
+
 void tst_SeasideFilteredModel::mixedFilters()
 {
     SeasideFilteredModel model;
@@ -1,13 +1,19 @@
 include(../common.pri)
 
+equals(QT_MAJOR_VERSION, 5): QT += concurrent
+
 HEADERS += \
         seasidecache.h \
         seasidefilteredmodel.h \
         $$SRCDIR/seasidefilteredmodel.h \
-        $$SRCDIR/seasideperson.h
+        $$SRCDIR/seasideperson.h \
+        $$SRCDIR/seasidequery.h \
+        $$SRCDIR/seasidesearchindex.h
 
 SOURCES += \
         seasidecache.cpp \
         tst_seasidefilteredmodel.cpp \
         $$SRCDIR/seasidefilteredmodel.cpp \
-        $$SRCDIR/seasideperson.cpp
+        $$SRCDIR/seasideperson.cpp \
+        $$SRCDIR/seasidequery.cpp \
+        $$SRCDIR/seasidesearchindex.cpp